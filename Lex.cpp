@@ -7,1067 +7,3740 @@
 #include <set>
 #include <array>
 #include <list>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdio>
+#include <chrono>
+#include <iomanip>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #include "Lex.h"
 
 using namespace std;
 
-// A special char is used to represent morphemes in regular expressions,
-// where the highest bit is 1 is an operator, otherwise it is an operand
+// A regular expression is parsed into a sequence of symbols (int),
+// where a symbol with the bit 0x80 set is an operator, a smaller one is an operand character,
+// and a symbol from CHARSET_BASE on is an operand that stands for a whole character set
+// (CHARSET_BASE + i is the i-th set of the character set table),
+// and a symbol from DEF_BASE on is an operand that stands for a whole regular definition
+// (DEF_BASE + i is the i-th definition)
+const int CHARSET_BASE = 0x100;
+const int DEF_BASE = 0x40000000;
 
 // Operand to operator
 // 0x80 <=> 0b10000000
-inline char to_operator(char ch)
+inline int to_operator(int ch)
 {
 	return ch | 0x80;
 }
 
-// int(to_operator('(') <=> -88
-// int(to_operator(')') <=> -87
-// int(to_operator('|') <=> -4
-// int(to_operator('.') <=> -82
-// int(to_operator('{') <=> -5
-// int(to_operator('}') <=> -3
-// int(to_operator('*') <=> -86
+// to_operator('(') <=> 0xa8
+// to_operator(')') <=> 0xa9
+// to_operator('|') <=> 0xfc
+// to_operator('.') <=> 0xae
+// to_operator('{') <=> 0xfb
+// to_operator('}') <=> 0xfd
+// to_operator('*') <=> 0xaa
 
 // Operator to operand
 // 0x7f <==> 0b01111111
-inline char to_char(char ch)
+inline int to_char(int ch)
 {
 	return ch & 0x7f;
 }
 // Determines whether it is an operator
-inline bool is_optr(char ch)
+inline bool is_optr(int ch)
 {
-	return ch & 0x80;
+	return (ch & 0x80) && ch < CHARSET_BASE;
 }
-
-// Definition of NFA
-
-// Single character to NFA
-NFA::NFA(char ch)
+// Determines whether it is a character set operand
+inline bool is_charset(int ch)
 {
-	NST s0, s1;
-	s0[(size_t)ch].push_back(1);
-	Ntran.push_back(s0);
-	Ntran.push_back(s1);
+	return ch >= CHARSET_BASE && ch < DEF_BASE;
+}
+// Determines whether it is a regular definition operand
+inline bool is_def(int ch)
+{
+	return ch >= DEF_BASE;
 }
 
-// Thompson: union
-void NFA::opt_union(const NFA &rhs)
-{ // Fetch union
-	size_t x = get_size();
-	size_t y = rhs.get_size();
-	Ntran.pop_back(); // Deletes the original accept state
-	for (auto &s : Ntran)
-	{ 	// The accept state is the last line of Ntran.
-		// All transitions to the original accept state are then 
-		// changed to the new accept state x + y - 3 ((x-1)+(y-1)-1)
-		for (auto &t : s)
-		{
-			for (auto &spt : t)
-			{
-				if (spt == x - 1)
-				{
-					spt = x + y - 3;
-				}
-			}
-		}
-	}
-	// Merge the states of the right
-	// automaton except for state 0 (conversion followed by all + (x-2))
-	for (size_t i = 1; i < y; ++i)
+// Renumber the classes as 0, 1, 2 ... in order of their smallest byte
+size_t renumber_classes(array<size_t, 256> &ec)
+{
+	vector<size_t> newNum(257, -1);
+	newNum[ec[255]] = 0; // Byte 255 is never in a label
+	size_t count = 1;
+	for (size_t b = 0; b < 256; ++b)
 	{
-		Ntran.push_back(rhs.Ntran[i]);
+		if (newNum[ec[b]] == (size_t)-1)
+		{
+			newNum[ec[b]] = count++;
+		}
+		ec[b] = newNum[ec[b]];
 	}
-	for (size_t i = x - 1; i < x + y - 2; ++i)
+	return count;
+}
+
+// Divide the bytes into equivalence classes: two bytes are in the same class if every
+// label contains both or neither of them. ec[b] is the class of byte b,
+// and class 0 holds the bytes that no label contains (at least 128 ~ 255).
+// Returns the number of classes
+size_t char_classes(const vector<CharSet> &labels, array<size_t, 256> &ec)
+{
+	ec.fill(0);
+	size_t count = 1;
+	vector<size_t> split(129); // Class of the bytes in the label, for each class before the split
+	for (const CharSet &cs : labels)
 	{
-		for (auto &t : Ntran[i])
+		split.assign(split.size(), -1);
+		for (size_t ch = 0; ch < 128; ++ch)
 		{
-			for (auto &spt : t)
+			if (cs.test(ch))
 			{
-				spt += x - 2;
+				if (split[ec[ch]] == (size_t)-1)
+				{
+					split[ec[ch]] = count++;
+				}
+				ec[ch] = split[ec[ch]];
 			}
 		}
+		if (count > 128)
+		{ // Renumber densely, so the numbers stay below 129
+			count = renumber_classes(ec);
+		}
 	}
-	// Merge the state 0 information of the right
-	// automaton (conversion followed by all + (x-2))
-	for (size_t ch = 0; ch < 129; ++ch)
+	return renumber_classes(ec);
+}
+
+// Definition of NFA
+
+// Single character to NFA
+// Add a character set label, and return the label
+uint32_t NFA::add_set(const CharSet &cs)
+{
+	sets.push_back(cs);
+	return 128 + sets.size();
+}
+
+// Append the character sets of rhs, and return the offset for its set labels
+uint32_t NFA::append_sets(const NFA &rhs)
+{
+	uint32_t setOffset = sets.size();
+	sets.insert(sets.end(), rhs.sets.begin(), rhs.sets.end());
+	return setOffset;
+}
+
+const uint32_t NO_EDGE = -1; // End of a dangling list
+
+// Add a dangling epsilon transition from a state, and return its index
+uint32_t NFA::add_dangling(uint32_t from)
+{
+	edges.push_back(Edge{from, NO_EDGE, 128});
+	return edges.size() - 1;
+}
+
+// Point all the dangling transitions of a list to a state
+void NFA::patch(uint32_t first, uint32_t to)
+{
+	while (first != NO_EDGE)
 	{
-		for (auto t : rhs.Ntran[0][ch])
-		{
-			Ntran[0][ch].push_back(t + x - 2);
-		}
+		uint32_t next = edges[first].to;
+		edges[first].to = to;
+		first = next;
 	}
 }
+
+// Thompson: character or character set, a new state with a dangling transition on the label
+NFA::Frag NFA::opt_label(uint32_t label)
+{
+	uint32_t s = nstates++;
+	edges.push_back(Edge{s, NO_EDGE, label});
+	uint32_t e = edges.size() - 1;
+	return Frag{s, e, e};
+}
+// Thompson: union
+NFA::Frag NFA::opt_union(Frag lhs, Frag rhs)
+{ // Fetch union
+	// A new start state with epsilon transitions to both starts,
+	// the dangling transitions of both become the dangling transitions of the union
+	uint32_t s = nstates++;
+	edges.push_back(Edge{s, lhs.start, 128});
+	edges.push_back(Edge{s, rhs.start, 128});
+	edges[lhs.outLast].to = rhs.outFirst;
+	return Frag{s, lhs.outFirst, rhs.outLast};
+}
 // Thompson: concatenate
-void NFA::opt_concat(const NFA &rhs)
+NFA::Frag NFA::opt_concat(Frag lhs, Frag rhs)
 { // concatenate
-	size_t x = get_size();
-	size_t y = rhs.get_size();
-	Ntran.pop_back(); // Deletes the original accept state
-	for (auto s : rhs.Ntran)
-	{ // Add all the right automaton states to the left
-		Ntran.push_back(s);
-	}
-	for (size_t i = x - 1; i < x + y - 1; ++i)
-	{
-		for (auto &t : Ntran[i])
-		{
-			for (auto &spt : t)
-			{
-				spt += x - 1;
-			}
-		}
-	}
+	// The dangling transitions of the left fragment go to the start of the right one
+	patch(lhs.outFirst, rhs.start);
+	return Frag{lhs.start, rhs.outFirst, rhs.outLast};
 }
 
 // Thompson: closure
-void NFA::opt_star()
+NFA::Frag NFA::opt_star(Frag f)
 { // closure
-	NST oldNtran0 = Ntran[0];
-	Ntran.pop_front();
-	Ntran.push_front(NST());							   // New start state 0
-	Ntran[0][128].push_back(Ntran.size() - 1);			   // Set the epsilon transition from 0 state to accepted state
-	*(Ntran.end() - 1) = oldNtran0;						   // Set the transition from the accept state to itself (same as the original 0 state)
-	Ntran.push_back(NST());								   // Add a new end state x
-	(*(Ntran.end() - 2))[128].push_back(Ntran.size() - 1); // Set the epsilon transition from the X-1 state to the x state
+	// A new state that both enters the fragment and leaves it, and the fragment loops back to it
+	uint32_t s = nstates++;
+	edges.push_back(Edge{s, f.start, 128});
+	patch(f.outFirst, s);
+	uint32_t e = add_dangling(s);
+	return Frag{s, e, e};
 }
 // Thompson: positive closure
-void NFA::opt_plus()
+NFA::Frag NFA::opt_plus(Frag f)
 { // positive closure
-	// This is equivalent to a & a*
-	NFA cp = *this;
-	cp.opt_star();
-	opt_concat(cp);
+	// As closure, but entered at the start of the fragment (a & a* without copying a)
+	uint32_t s = nstates++;
+	patch(f.outFirst, s);
+	edges.push_back(Edge{s, f.start, 128});
+	uint32_t e = add_dangling(s);
+	return Frag{f.start, e, e};
 }
 // Thompson: question mark
-void NFA::opt_quest()
+NFA::Frag NFA::opt_quest(Frag f)
 { // 0 or 1
-	// Add an epsilon transition from the initial state to the accepted state
-	Ntran[0][128].push_back(Ntran.size() - 1);
+	// A new start state that either enters the fragment or leaves at once
+	uint32_t s = nstates++;
+	edges.push_back(Edge{s, f.start, 128});
+	uint32_t e = add_dangling(s);
+	edges[f.outLast].to = e;
+	return Frag{s, f.outFirst, e};
+}
+// Keep the fragment, which must be the whole NFA, to copy it
+NFA::Template NFA::save_template(Frag f) const
+{
+	Template t;
+	t.edges = edges;
+	t.linked.assign(edges.size(), false);
+	for (uint32_t e = f.outFirst; e != NO_EDGE; e = edges[e].to)
+	{
+		t.linked[e] = true;
+	}
+	t.nstates = nstates;
+	t.frag = f;
+	return t;
+}
+// A copy of a saved fragment: its states and edges after those of the NFA, so the states and
+// the dangling links move by an offset, and its set labels mapped with setLabel
+NFA::Frag NFA::opt_copy(const Template &t, const vector<uint32_t> &setLabel)
+{
+	uint32_t ds = nstates, de = edges.size();
+	for (size_t i = 0; i < t.edges.size(); ++i)
+	{
+		Edge e = t.edges[i];
+		e.from += ds;
+		e.to = t.linked[i] ? (e.to == NO_EDGE ? NO_EDGE : e.to + de) : e.to + ds;
+		e.label = e.label > 128 ? setLabel[e.label - 129] : e.label;
+		edges.push_back(e);
+	}
+	nstates += t.nstates;
+	return Frag{t.frag.start + ds, t.frag.outFirst + de, t.frag.outLast + de};
+}
+// Close the fragment of a whole rule: the dangling transitions go to a new accept state,
+// the last state, and the start state is swapped with state 0
+void NFA::finish(Frag f)
+{
+	uint32_t acc = nstates++;
+	patch(f.outFirst, acc);
+	if (f.start != 0)
+	{
+		for (auto &e : edges)
+		{
+			e.from = e.from == 0 ? f.start : e.from == f.start ? 0 : e.from;
+			e.to = e.to == 0 ? f.start : e.to == f.start ? 0 : e.to;
+		}
+	}
 }
 // A series of Nfas are merged to return the sequence number of the accepted states,
 // that is, the accepted state corresponding to the I-th automaton is stored in the I-th position
 vector<size_t> NFA::merge_nfa(const vector<NFA> &nfas)
 {
 	vector<size_t> accepts;
-	Ntran.clear();
-	Ntran.push_back(NST()); // Create a new NFA with only the start state
-	size_t offset = 1;
-	for (auto nfa : nfas)
+	edges.clear(); // Create a new NFA with only the start state
+	sets.clear();
+	uint32_t offset = 1;
+	for (const NFA &nfa : nfas)
+	{
+		edges.push_back(Edge{0, offset, 128}); // epsilon transition from new state 0 to the initial state of the automaton to be merged
+		uint32_t setOffset = append_sets(nfa);
+		for (Edge e : nfa.edges)
+		{ // Adds all states of the automaton to be merged
+			e.from += offset; // Status number plus offset
+			e.to += offset;
+			e.label += e.label > 128 ? setOffset : 0;
+			edges.push_back(e);
+		}
+		offset += nfa.nstates;
+		accepts.push_back(offset - 1); // add accept state
+	}
+	nstates = offset;
+	build_rows(); // The merged NFA is the one to be determinized
+	return accepts;
+}
+
+// Lay the edge list out per state (compressed sparse rows), character transitions sorted by
+// character and epsilon transitions apart, then precompute the epsilon closure of every single
+// state, so that the closure of a set is only the union of the closures of its members
+void NFA::build_rows()
+{
+	tranStart.assign(nstates + 1, 0);
+	epsStart.assign(nstates + 1, 0);
+	for (const Edge &e : edges)
+	{
+		++(e.label == 128 ? epsStart : tranStart)[e.from + 1];
+	}
+	for (uint32_t s = 0; s < nstates; ++s)
+	{
+		tranStart[s + 1] += tranStart[s];
+		epsStart[s + 1] += epsStart[s];
+	}
+	tran.resize(tranStart[nstates]);
+	eps.resize(epsStart[nstates]);
+	vector<uint32_t> tranFill(tranStart.begin(), tranStart.end() - 1);
+	vector<uint32_t> epsFill(epsStart.begin(), epsStart.end() - 1);
+	for (const Edge &e : edges)
 	{
-		Ntran[0][128].push_back(offset); // epsilon transition from new state 0 to the initial state of the automaton to be merged
-		size_t size = nfa.get_size();
-		for (auto s : nfa.Ntran)
+		if (e.label == 128)
 		{
-			Ntran.push_back(s); // Adds all states of the automaton to be merged
+			eps[epsFill[e.from]++] = e.to;
 		}
-		for (size_t i = 0; i < size; ++i)
+		else
+		{
+			tran[tranFill[e.from]++] = Tran{e.to, e.label};
+		}
+	}
+	for (uint32_t s = 0; s < nstates; ++s)
+	{
+		sort(tran.begin() + tranStart[s], tran.begin() + tranStart[s + 1],
+			 [](const Tran &l, const Tran &r) { return l.label < r.label || (l.label == r.label && l.to < r.to); });
+	}
+	vector<Edge>().swap(edges); // The rows replace the edge list
+
+	closStart.assign(1, 0);
+	closure.clear();
+	SparseSet resSet(nstates);
+	vector<uint32_t> stk;
+	for (uint32_t s = 0; s < nstates; ++s)
+	{
+		resSet.clear();
+		resSet.insert(s);
+		stk.push_back(s);
+		while (!stk.empty())
 		{
-			for (auto &t : Ntran[i + offset])
+			uint32_t t = stk.back();
+			stk.pop_back();
+			for (uint32_t i = epsStart[t]; i < epsStart[t + 1]; ++i)
 			{
-				for (auto &spt : t)
+				if (resSet.insert(eps[i]))
 				{
-					spt += offset; // Status number plus offset
+					stk.push_back(eps[i]);
 				}
 			}
 		}
-		offset += size;
-		accepts.push_back(offset - 1); // add accept state
+		size_t first = closure.size();
+		closure.insert(closure.end(), resSet.begin(), resSet.end());
+		sort(closure.begin() + first, closure.end());
+		closStart.push_back(closure.size());
 	}
-	return accepts;
 }
 
 // Find an epsilon closure of a state
-vector<size_t> NFA::epsilon_closure(size_t s) const
+vector<uint32_t> NFA::epsilon_closure(uint32_t s) const
 {
-	vector<size_t> tmp{s};
-	return epsilon_closure(tmp);
+	return vector<uint32_t>(closure.begin() + closStart[s], closure.begin() + closStart[s + 1]);
 }
 // Find the epsilon closure of a set of states
-vector<size_t> NFA::epsilon_closure(const vector<size_t> &ss) const
+vector<uint32_t> NFA::epsilon_closure(const vector<uint32_t> &ss) const
 {
-	set<size_t> resSet(ss.begin(), ss.end()); // Initialize the resSet with ss
-	stack<size_t, vector<size_t>> stk(ss);	  // Initialize the stack with ss
-	while (!stk.empty())
-	{
-		size_t t = stk.top();
-		stk.pop();
-		for (size_t u : Ntran[t][128])
+	SparseSet resSet(nstates);
+	for (uint32_t t : ss)
+	{ // Union of the precomputed closures
+		for (size_t i = closStart[t]; i < closStart[t + 1]; ++i)
 		{
-			if (!resSet.count(u))
-			{
-				resSet.insert(u);
-				stk.push(u);
-			}
+			resSet.insert(closure[i]);
 		}
 	}
-	vector<size_t> res; // The result is converted to a vector only for the convenience of function calls
-	for (size_t i : resSet)
-	{ // Note that the returned vector must be sorted
-		res.push_back(i);
-	}
+	vector<uint32_t> res(resSet.begin(), resSet.end());
+	sort(res.begin(), res.end()); // Note that the returned vector must be sorted
 	return res;
 }
 
 // move function that finds a set of states (the result of this function is
-// not a set, may have duplicate elements, but is always used along with epsilon closures)
-vector<size_t> NFA::move(const vector<size_t> &ss, char a) const
+// not a set, may have duplicate elements, but is always used along with epsilon closures).
+// ss must already be closed under epsilon transitions, as every DFA state is
+vector<uint32_t> NFA::move(const vector<uint32_t> &ss, char a) const
 {
-	vector<size_t> res;
-	vector<size_t> ec = epsilon_closure(ss);
-	for (size_t s : ec)
+	vector<uint32_t> res;
+	for (uint32_t s : ss)
 	{
-		for (size_t d : Ntran[s][(size_t)a])
+		for (uint32_t i = tranStart[s]; i < tranStart[s + 1]; ++i)
 		{
-			res.push_back(d);
+			if (label_has(tran[i].label, (size_t)a))
+			{
+				res.push_back(tran[i].to);
+			}
 		}
 	}
 	return res;
 }
 
-// Definition of DFA
-
-// Initialize the DFA with the merged NFA (multiple accept states)
-DFA::DFA(const NFA &nfa, const vector<size_t> &nacn)
+// epsilon_closure(move(T, a)) for a closed set T = [first, last), without temporaries:
+// the sorted result is written to res, scratch must be sized to the NFA
+void NFA::move_closure(const uint32_t *first, const uint32_t *last, size_t a, SparseSet &scratch, vector<uint32_t> &res) const
 {
-
-	vector<vector<size_t>> Dstates; // Each state of the DFA corresponds to a set of states of the NFA
-	stack<size_t> unFlaged;			// Unmarked DFA status
-
-	Dstates.push_back(nfa.epsilon_closure(0)); // Dstates started with epsilon-closure(s0)
-	Dtran.push_back(newDST());				   // Add a state to Dtran
-	unFlaged.push(0);						   // And not marked
-
-	while (!unFlaged.empty())
+	scratch.clear();
+	for (const uint32_t *s = first; s != last; ++s)
 	{
-		size_t Tidx = unFlaged.top(); // Retrieves an unmarked DFA state
-		unFlaged.pop();
-		size_t Uidx = 0;
-		vector<size_t> T = Dstates[Tidx]; // The corresponding set of NFA states
-		for (size_t a = 0; a < 128; ++a)
+		for (uint32_t i = tranStart[*s]; i < tranStart[*s + 1]; ++i)
 		{
-			vector<size_t> U = nfa.epsilon_closure(nfa.move(T, (char)a));
-			if (!U.empty())
-			{ // There is a conversion
-				bool UinDstates = false;
-				for (size_t i = 0; i < Dstates.size(); ++i)
-				{ // Determine whether U is in Dstates
-					if (U == Dstates[i])
-					{ 	// Because the results of the functions that evaluate epsilon
-						// closures are all sorted, they can be directly compared
-						UinDstates = true;
-						Uidx = i;
-						break;
-					}
-				}
-				if (!UinDstates)
-				{							   // U is not in Dstates
-					Dstates.push_back(U);	   // add into Dstates
-					Dtran.push_back(newDST()); // Add a state to Dtran
-					Uidx = Dstates.size() - 1;
-					unFlaged.push(Uidx); // And not marked
-				}
-				Dtran[Tidx][(size_t)a] = Uidx;
+			uint32_t d = tran[i].to;
+			if (!label_has(tran[i].label, a) || scratch.contains(d))
+			{
+				continue;
 			}
-		}
-	}
-
-	for (size_t i = 0; i < Dstates.size(); ++i)
-	{							 // Determine whether the DFA status is accepted
-		size_t firstAccept = -1; // Takes the first listed pattern corresponding to the accepted state
-		for (auto s : Dstates[i])
-		{
-			if (nacn[s] != -1)
+			for (size_t j = closStart[d]; j < closStart[d + 1]; ++j)
 			{
-				// -1 + size_t => very very large
-				firstAccept = nacn[s] < firstAccept ? nacn[s] : firstAccept;
+				scratch.insert(closure[j]);
 			}
 		}
-		accepts.push_back(firstAccept);
 	}
+	res.assign(scratch.begin(), scratch.end());
+	sort(res.begin(), res.end());
 }
 
-// minimize DFA
-void DFA::minimize() {
-	vector<size_t> sttGroup(get_size());	// The group to which the status belongs
-	vector<set<size_t>> grpStates;			// What states are in each group
-	size_t maxAccNum = 0;					// Maximum acceptance status number
-	for (auto n : accepts) {
-		if (n != -1) {
-			maxAccNum = n > maxAccNum ? n : maxAccNum;
-		}
-	}
-	for (size_t i = 0; i < maxAccNum + 2; ++i) {	// Initially, there are maxAccNum + 2 groups
-													// Corresponding to maxAccNum + 1 different accept status groups
-													// And 1 other status group
-		grpStates.push_back(set<size_t>());
-	}
-	for (size_t i = 0; i < get_size(); ++i) {
-		if (accepts[i] == -1) {				// The state of non-acceptance
-			sttGroup[i] = maxAccNum + 1;
-			grpStates[maxAccNum + 1].insert(i);
-		}
-		else {
-			sttGroup[i] = accepts[i];
-			grpStates[accepts[i]].insert(i);
-		}
-	}
-	bool modified = false;
-	do {
-		modified = false;
-		for (auto g : grpStates) {
-			if (g.size() == 1) {					// If there is only one state in the group, it is not considered
-				continue;
-			}
-			else {
-				vector<size_t> helper;
-				set<size_t>::iterator begin = g.begin();
-				for (set<size_t>::iterator s = g.begin(); s != g.end(); ++s) {
-					if(s == begin)
-						continue;
-					if(!modified) {
-						for (size_t ch = 0; ch < 128; ++ch) {
-							if ((Dtran[*begin][ch] != Dtran[*s][ch])&&(sttGroup[Dtran[*begin][ch]] != sttGroup[Dtran[*s][ch]])) {
-								modified = true;
-								helper.push_back(*s);
-							}
-						}
-					}
-					else {
-						size_t a = helper[0];
-						bool In_The_Same_Group = true;
-						for (size_t ch = 0; ch < 128; ++ch) {
-							if ((Dtran[*begin][ch] != Dtran[*s][ch])&&(sttGroup[Dtran[*begin][ch]] != sttGroup[Dtran[*s][ch]])) {
-								In_The_Same_Group = false;
-							}
-						}
-						if(In_The_Same_Group)
-							helper.push_back(*s);
-					}
-				}
-				set<size_t> newset;
-				if(helper.size() != 0) {
-					for(auto a: helper) {
-						g.erase(a);
-						sttGroup[a] = grpStates.size();
-						newset.insert(a);
-					}
-					grpStates.push_back(newset);
-				}
-			}
-		}
-	} while (modified);
-
-	size_t newstatessize = grpStates.size();
-
-	vector<DST> newDtran;
-	int size = grpStates.size();
-	stack<size_t> unFlaged;
-	newDtran.push_back(newDST());
-	unFlaged.push(0);
-
-	while (!unFlaged.empty()) {
-		size_t Tidx = unFlaged.top();
-		unFlaged.pop();
-		int i;
-		for(i=0; i < sttGroup.size(); i++)
-			if(sttGroup[i] == Tidx)
-				break;
-		for (size_t a = 0; a < 128; ++a)
+// Equivalence classes of the bytes for the transition labels of this NFA
+size_t NFA::char_classes(array<size_t, 256> &ec) const
+{
+	vector<CharSet> labels(sets);
+	bool seen[128] = {false}; // Single character labels already added
+	for (const Tran &t : tran)
+	{
+		if (t.label < 128 && !seen[t.label])
 		{
-			int trans = Dtran[i][a];
-			
+			seen[t.label] = true;
+			labels.push_back(CharSet().set(t.label));
 		}
 	}
+	return ::char_classes(labels, ec);
 }
 
-// Delete dead state
-void DFA::delete_dead_states() {
-	for (size_t i = 0; i < get_size(); ++i) {
-		if (accepts[i] != -1) {				// accept state, skip.
-			continue;
-		}
-		else {
-			
-		}
-	}
-}
+// Definition of the regular expression DAG
 
-// Determine whether ch is a character that must be escaped in a regular expression
-// Regular expressions use the backslash character ('\') to indicate special forms or
-// to allow special characters to be used without invoking their special meaning.
-// For example, In lex files, the backslash followed by a question mark (?) is typically
-// used to match a literal question mark character (?).
-inline bool need_escape(char ch)
+// Return the node (op, sym, left, right), adding it if there is no such node yet
+uint32_t RegexDag::add_node(int op, int sym, uint32_t left, uint32_t right)
 {
-	if (ch == '\\' || ch == '\"' || ch == '.' || ch == '^' || ch == '$' || ch == '[' || ch == ']' || ch == '*' || ch == '+' || ch == '?' || ch == '{' || ch == '}' || ch == '|' || ch == '/' || ch == '(' || ch == ')')
+	std::tuple<int, int, uint32_t, uint32_t> key(op, sym, left, right);
+	map<std::tuple<int, int, uint32_t, uint32_t>, uint32_t>::const_iterator it = nodeIndex.find(key);
+	if (it != nodeIndex.end())
 	{
-		return true;
+		return it->second;
+	}
+	Node nd;
+	nd.op = op;
+	nd.sym = sym;
+	nd.left = left;
+	nd.right = right;
+	// FNV-1a over the operator and the operand members or the hashes of the children,
+	// so equal expressions hash equal whatever their node numbers
+	nd.hash = 14695981039346656037ULL;
+	auto mix = [&nd](uint64_t v)
+	{
+		nd.hash ^= v;
+		nd.hash *= 1099511628211ULL;
+	};
+	mix(op);
+	if (op == 0 && is_charset(sym))
+	{
+		const CharSet &cs = sets[sym - CHARSET_BASE];
+		mix(CHARSET_BASE);
+		mix((cs >> 64).to_ullong());
+		mix((cs & CharSet(0xffffffffffffffffULL)).to_ullong());
+	}
+	else if (op == 0)
+	{
+		mix(sym);
 	}
 	else
 	{
-		return false;
+		mix(nodes[left].hash);
+		mix(nodes[right].hash);
 	}
+	nodes.push_back(nd);
+	nodeIndex.insert(make_pair(key, nodes.size() - 1));
+	return nodes.size() - 1;
 }
 
-// Determines whether it is an operator, i.e. a backslash that
-// previously had no real meaning (an even number of consecutive backslashes)
-inline bool is_not_escaped(string::const_iterator it, const string &str)
+// Add a suffix expression and return its node:
+// Character sets are looked up by their members, and DEF_BASE + i is the node defRoots[i]
+uint32_t RegexDag::add_suffix(const vector<int> &seq, const vector<CharSet> &charSets, const vector<uint32_t> &defRoots)
 {
-	if (it == str.begin())
-	{
-		return true;
-	}
-	else
+	stack<uint32_t> s;
+	for (vector<int>::const_iterator it = seq.begin(); it != seq.end(); ++it)
 	{
-		it--;
-		int backSlashCount = 0;
-		for (; it != str.begin(); --it)
+		if (is_def(*it))
 		{
-			if (*it == '\\')
-			{
-				++backSlashCount;
-			}
-			else
+			s.push(defRoots[*it - DEF_BASE]);
+		}
+		else if (is_charset(*it))
+		{
+			const CharSet &cs = charSets[*it - CHARSET_BASE];
+			std::pair<uint64_t, uint64_t> members((cs >> 64).to_ullong(), (cs & CharSet(0xffffffffffffffffULL)).to_ullong());
+			if (!setIndex.count(members))
 			{
-				break;
+				setIndex.insert(make_pair(members, CHARSET_BASE + (int)sets.size()));
+				sets.push_back(cs);
 			}
+			s.push(add_node(0, setIndex.at(members), 0, 0));
 		}
-		if (backSlashCount % 2 == 0)
+		else if (!is_optr(*it))
 		{
-			return true;
+			s.push(add_node(0, *it, 0, 0));
 		}
-		else
+		else if (to_char(*it) == '|' || to_char(*it) == '&')
 		{
-			return false;
+			uint32_t rhs = s.top();
+			s.pop();
+			uint32_t lhs = s.top();
+			s.pop();
+			s.push(add_node(to_char(*it), 0, lhs, rhs));
+		}
+		else if (to_char(*it) == '*' || to_char(*it) == '+' || to_char(*it) == '?')
+		{
+			uint32_t lhs = s.top();
+			s.pop();
+			s.push(add_node(to_char(*it), 0, lhs, lhs));
 		}
 	}
+	return s.top();
 }
 
-// Analyzes two parts of a line separated by tabs.
-pair<string, string> split_by_blank(const string &str)
+// The nodes of the tree that root stands for, in suffix order
+// (a node shared by several subtrees appears once for each of them).
+// The nodes below root with stop[i] set appear without their subtrees
+void RegexDag::expand(uint32_t root, vector<uint32_t> &order, const vector<bool> *stop) const
 {
-	bool flag = true;
-	string name, expr;
-	for (auto c : str)
+	order.clear();
+	vector<pair<uint32_t, int>> stk; // Node and the number of children already visited
+	stk.push_back(make_pair(root, 0));
+	while (!stk.empty())
 	{
-		if (flag)
+		const Node &nd = nodes[stk.back().first];
+		int arity = nd.op == 0 ? 0 : (nd.op == '|' || nd.op == '&') ? 2 : 1;
+		if (stop && stk.size() > 1 && (*stop)[stk.back().first])
 		{
-			if (c != '\t')
-			{
-				name.push_back(c);
-			}
-			else
-			{
-				flag = false;
-			}
+			arity = 0;
+		}
+		int done = stk.back().second;
+		if (done == arity)
+		{
+			order.push_back(stk.back().first);
+			stk.pop_back();
 		}
 		else
 		{
-			if (c != '\t')
-			{
-				expr.push_back(c);
-			}
-			else
-			{
-				if (expr.empty())
-					continue;
-				else
-					break;
-			}
+			++stk.back().second;
+			stk.push_back(make_pair(done == 0 ? nd.left : nd.right, 0));
 		}
 	}
-	return pair<string, string>(name, expr);
 }
 
-// "." is just a point
-// . is a operator
-
-// Parses a regular expression string into a sequence of symbols and handles parentheses and quotes
-vector<char> deal_brkt_qt(const string &exp)
+// The operator nodes that the rules reach more than once, through several parents or as a rule
+// and a subexpression (such as {IS} in minic.l): the ones worth building once and copying
+vector<bool> RegexDag::shared_nodes(const vector<uint32_t> &roots) const
 {
-
-	vector<char> res;
-	string inBracket;			 // The actual character in the bracket([])
-	bool bracketFlag = false;	 // Detection bracket
-	bool notBracketFlag = false; // Detection bracket（Complement form）
-	bool quotationFlag = false;	 // Detection quotes
-
-	// const_iterator
-	// dereferencing converts the value returned by the underlying iterator as immutable.
-	for (string::const_iterator it = exp.begin(); it != exp.end(); ++it)
+	vector<uint32_t> uses(nodes.size(), 0);
+	vector<bool> seen(nodes.size(), false);
+	vector<uint32_t> stk;
+	for (uint32_t r : roots)
 	{
-		// Enter quotes, and inside brackets do not count
-		if (!quotationFlag && !bracketFlag && !notBracketFlag && *it == '\"' && is_not_escaped(it, exp))
+		++uses[r];
+		if (!seen[r])
 		{
-			quotationFlag = true;
+			seen[r] = true;
+			stk.push_back(r);
 		}
-		// End of quote
-		else if (quotationFlag && !bracketFlag && !notBracketFlag && *it == '\"' && is_not_escaped(it, exp))
+	}
+	while (!stk.empty())
+	{
+		const Node &nd = nodes[stk.back()];
+		stk.pop_back();
+		if (nd.op == 0)
 		{
-			quotationFlag = false;
+			continue;
 		}
-		// Inside quotation("") marks
-		else if (quotationFlag)
+		vector<uint32_t> children(1, nd.left);
+		if (nd.op == '|' || nd.op == '&')
 		{
-			res.push_back(*it);
+			children.push_back(nd.right);
 		}
-		// enter bracket ([]).
-		else if (!bracketFlag && !notBracketFlag && *it == '[' && is_not_escaped(it, exp))
+		for (uint32_t c : children)
 		{
-			// the caret symbol (^)
-			// This operator is used to match any character
-			// except the ones specified following the caret.
-			if (*(it + 1) != '^')
-			{
-				bracketFlag = true;
-			}
-			else
+			++uses[c];
+			if (!seen[c])
 			{
-				++it;
-				notBracketFlag = true;
+				seen[c] = true;
+				stk.push_back(c);
 			}
-			inBracket.clear();
 		}
-		// End of bracket
-		else if (bracketFlag && *it == ']' && is_not_escaped(it, exp))
+	}
+	vector<bool> shared(nodes.size(), false);
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		shared[i] = uses[i] > 1 && nodes[i].op != 0;
+	}
+	return shared;
+}
+
+// Definition of the syntax tree (followpos)
+
+// Add a leaf, that is a new position
+uint32_t RegexTree::add_leaf(const CharSet &cs, size_t rule)
+{
+	uint32_t pos = labels.size();
+	labels.push_back(cs);
+	posAccept.push_back(rule);
+	followpos.push_back(vector<uint32_t>());
+	Node nd;
+	nd.op = 0;
+	nd.left = nd.right = pos;
+	nd.nullable = false;
+	nd.firstpos.push_back(pos);
+	nd.lastpos.push_back(pos);
+	nodes.push_back(nd);
+	return nodes.size() - 1;
+}
+
+// Add an operator node, compute its nullable, firstpos and lastpos,
+// and add what it contributes to followpos
+uint32_t RegexTree::add_node(int op, uint32_t left, uint32_t right)
+{
+	Node nd;
+	nd.op = op;
+	nd.left = left;
+	nd.right = right;
+	const Node &c1 = nodes[left];
+	const Node &c2 = nodes[right];
+	if (op == '|')
+	{
+		nd.nullable = c1.nullable || c2.nullable;
+		set_union(c1.firstpos.begin(), c1.firstpos.end(), c2.firstpos.begin(), c2.firstpos.end(), back_inserter(nd.firstpos));
+		set_union(c1.lastpos.begin(), c1.lastpos.end(), c2.lastpos.begin(), c2.lastpos.end(), back_inserter(nd.lastpos));
+	}
+	else if (op == '&')
+	{
+		nd.nullable = c1.nullable && c2.nullable;
+		if (c1.nullable)
+		{
+			set_union(c1.firstpos.begin(), c1.firstpos.end(), c2.firstpos.begin(), c2.firstpos.end(), back_inserter(nd.firstpos));
+		}
+		else
+		{
+			nd.firstpos = c1.firstpos;
+		}
+		if (c2.nullable)
+		{
+			set_union(c1.lastpos.begin(), c1.lastpos.end(), c2.lastpos.begin(), c2.lastpos.end(), back_inserter(nd.lastpos));
+		}
+		else
+		{
+			nd.lastpos = c2.lastpos;
+		}
+		for (uint32_t i : c1.lastpos)
+		{ // Every position of firstpos(c2) can follow a position of lastpos(c1)
+			followpos[i].insert(followpos[i].end(), c2.firstpos.begin(), c2.firstpos.end());
+		}
+	}
+	else
+	{ // '*', '+' and '?' only have a left child
+		nd.nullable = op == '+' ? c1.nullable : true;
+		nd.firstpos = c1.firstpos;
+		nd.lastpos = c1.lastpos;
+		if (op != '?')
+		{
+			for (uint32_t i : c1.lastpos)
+			{ // The closure can start over after its last position
+				followpos[i].insert(followpos[i].end(), c1.firstpos.begin(), c1.firstpos.end());
+			}
+		}
+	}
+	nodes.push_back(nd);
+	return nodes.size() - 1;
+}
+
+// Add the next rule as (rule)#, a new position for each operand of its tree
+void RegexTree::add_rule(const RegexDag &dag, uint32_t root, const vector<bool> &shared)
+{
+	size_t rule = roots.size();
+	uint32_t node = add_subtree(dag, root, shared);
+	uint32_t endMarker = add_leaf(CharSet(), rule);
+	roots.push_back(add_node('&', node, endMarker));
+}
+
+// Add the tree that a DAG node stands for and return its root: the subtree of a shared node
+// is built at its first use and copied at the others
+uint32_t RegexTree::add_subtree(const RegexDag &dag, uint32_t root, const vector<bool> &shared)
+{
+	if (shared[root] && copies.count(root))
+	{
+		return copy_subtree(copies.at(root));
+	}
+	uint32_t firstPos = labels.size();
+	stack<uint32_t> s;
+	vector<uint32_t> order;
+	dag.expand(root, order, &shared);
+	for (uint32_t i : order)
+	{
+		const RegexDag::Node &nd = dag.get_node(i);
+		if (i != root && shared[i])
+		{
+			s.push(add_subtree(dag, i, shared));
+		}
+		else if (nd.op == 0)
+		{
+			s.push(add_leaf(is_charset(nd.sym) ? dag.get_set(nd.sym - CHARSET_BASE) : CharSet().set(nd.sym), -1));
+		}
+		else if (nd.op == '|' || nd.op == '&')
+		{
+			uint32_t rhs = s.top();
+			s.pop();
+			uint32_t lhs = s.top();
+			s.pop();
+			s.push(add_node(nd.op, lhs, rhs));
+		}
+		else
+		{
+			uint32_t lhs = s.top();
+			s.pop();
+			s.push(add_node(nd.op, lhs, lhs));
+		}
+	}
+	if (shared[root])
+	{ // Only the followpos within the subtree so far, the enclosing nodes add the rest
+		Copy &c = copies[root];
+		c.firstPos = firstPos;
+		c.endPos = labels.size();
+		c.node = s.top();
+		c.followpos.assign(followpos.begin() + firstPos, followpos.end());
+	}
+	return s.top();
+}
+
+// Copy a subtree: new positions with the labels and the followpos of its positions, and a
+// new root with its firstpos and lastpos, all moved by the same offset
+uint32_t RegexTree::copy_subtree(const Copy &c)
+{
+	uint32_t d = labels.size() - c.firstPos;
+	for (uint32_t p = c.firstPos; p < c.endPos; ++p)
+	{
+		CharSet cs = labels[p];
+		labels.push_back(cs);
+		posAccept.push_back(-1);
+		followpos.push_back(c.followpos[p - c.firstPos]);
+		for (uint32_t &q : followpos.back())
+		{
+			q += d;
+		}
+	}
+	Node nd = nodes[c.node];
+	for (uint32_t &q : nd.firstpos)
+	{
+		q += d;
+	}
+	for (uint32_t &q : nd.lastpos)
+	{
+		q += d;
+	}
+	nodes.push_back(nd);
+	return nodes.size() - 1;
+}
+
+// Called after the last rule: the start is firstpos of the whole tree
+void RegexTree::finish()
+{
+	start.clear();
+	for (uint32_t r : roots)
+	{
+		const vector<uint32_t> &fp = nodes[r].firstpos;
+		start.insert(start.end(), fp.begin(), fp.end());
+	}
+	sort(start.begin(), start.end());
+	start.erase(unique(start.begin(), start.end()), start.end());
+	for (auto &fp : followpos)
+	{
+		sort(fp.begin(), fp.end());
+		fp.erase(unique(fp.begin(), fp.end()), fp.end());
+	}
+}
+
+// Equivalence classes of the bytes for the labels of the positions
+size_t RegexTree::char_classes(array<size_t, 256> &ec) const
+{
+	return ::char_classes(labels, ec);
+}
+
+// Definition of DFA
+
+// Interned sets of NFA states: the sorted members of every set are stored one after
+// another in a single arena, and an open-addressing hash table maps a set to its index
+class StateSetTable
+{
+public:
+	StateSetTable() : starts(1, 0), buckets(64, -1) {}
+	// Returns the index of the set, and whether it was added just now
+	pair<size_t, bool> intern(const vector<uint32_t> &ss) { return intern(ss, hash_of(ss)); }
+	pair<size_t, bool> intern(const vector<uint32_t> &ss, size_t h);
+	inline size_t get_size() const { return hashes.size(); }
+	static size_t hash_of(const vector<uint32_t> &ss);
+	inline const uint32_t *begin(size_t i) const { return arena.data() + starts[i]; }
+	inline const uint32_t *end(size_t i) const { return arena.data() + starts[i + 1]; }
+
+private:
+	vector<uint32_t> arena; // Members of all sets
+	vector<size_t> starts;	// The i-th set is arena[starts[i], starts[i + 1])
+	vector<size_t> hashes;	// Hash of each set, kept to rehash and to skip most comparisons
+	vector<size_t> buckets; // Set index or -1, the size is always a power of 2
+
+	void grow();
+};
+
+size_t StateSetTable::hash_of(const vector<uint32_t> &ss)
+{ // FNV-1a over the members
+	size_t h = 14695981039346656037ULL;
+	for (uint32_t s : ss)
+	{
+		h ^= s;
+		h *= 1099511628211ULL;
+	}
+	return h ^ (h >> 29);
+}
+
+void StateSetTable::grow()
+{
+	buckets.assign(buckets.size() * 2, -1);
+	size_t mask = buckets.size() - 1;
+	for (size_t i = 0; i < hashes.size(); ++i)
+	{
+		size_t b = hashes[i] & mask;
+		while (buckets[b] != (size_t)-1)
+		{
+			b = (b + 1) & mask;
+		}
+		buckets[b] = i;
+	}
+}
+
+pair<size_t, bool> StateSetTable::intern(const vector<uint32_t> &ss, size_t h)
+{
+	size_t mask = buckets.size() - 1;
+	size_t b = h & mask;
+	for (; buckets[b] != (size_t)-1; b = (b + 1) & mask)
+	{ // Linear probing
+		size_t i = buckets[b];
+		if (hashes[i] == h && (size_t)(end(i) - begin(i)) == ss.size() && equal(ss.begin(), ss.end(), begin(i)))
+		{
+			return pair<size_t, bool>(i, false);
+		}
+	}
+	size_t idx = hashes.size();
+	buckets[b] = idx;
+	hashes.push_back(h);
+	arena.insert(arena.end(), ss.begin(), ss.end());
+	starts.push_back(arena.size());
+	if (hashes.size() * 2 > buckets.size())
+	{ // Keep the load factor under 1/2
+		grow();
+	}
+	return pair<size_t, bool>(idx, true);
+}
+
+// Interned sets shared by the workers of the parallel subset construction:
+// the table is split into shards by hash, each shard with its own lock,
+// and the DFA state numbers are handed out by one atomic counter
+class ConcurrentStateSetTable
+{
+public:
+	ConcurrentStateSetTable() : next(0) {}
+	// Returns the DFA state number of the set, and whether it was added just now
+	pair<size_t, bool> intern(const vector<uint32_t> &ss);
+	inline size_t get_size() const { return next; }
+
+private:
+	static const size_t SHARDS = 64;
+	struct Shard
+	{
+		mutex lock;
+		StateSetTable sets;
+		vector<size_t> ids; // DFA state number of each set of the shard
+	};
+	Shard shards[SHARDS];
+	atomic<size_t> next;
+};
+
+pair<size_t, bool> ConcurrentStateSetTable::intern(const vector<uint32_t> &ss)
+{
+	size_t h = StateSetTable::hash_of(ss);
+	Shard &sh = shards[(h >> 7) % SHARDS];
+	lock_guard<mutex> guard(sh.lock);
+	pair<size_t, bool> local = sh.sets.intern(ss, h);
+	if (local.second)
+	{
+		sh.ids.push_back(next++);
+	}
+	return pair<size_t, bool>(sh.ids[local.first], local.second);
+}
+
+// Run f(0) ... f(n - 1) on up to `threads` threads, each taking the next index
+void parallel_for(size_t n, unsigned threads, const function<void(size_t)> &f)
+{
+	atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < n; i = next++)
+		{
+			f(i);
+		}
+	};
+	vector<thread> pool;
+	for (unsigned t = 1; t < threads && t < n; ++t)
+	{
+		pool.push_back(thread(worker));
+	}
+	worker();
+	for (auto &th : pool)
+	{
+		th.join();
+	}
+}
+
+// The first listed pattern accepted by a set of NFA states, -1 if none
+size_t first_accept(const uint32_t *first, const uint32_t *last, const vector<size_t> &nacn)
+{
+	size_t firstAccept = -1;
+	for (const uint32_t *s = first; s != last; ++s)
+	{
+		if (nacn[*s] != (size_t)-1)
+		{
+			// -1 + size_t => very very large
+			firstAccept = nacn[*s] < firstAccept ? nacn[*s] : firstAccept;
+		}
+	}
+	return firstAccept;
+}
+
+// Initialize the DFA with the merged NFA (multiple accept states)
+// The DFA works on the equivalence classes of the bytes instead of the bytes themselves
+DFA::DFA(const NFA &nfa, const vector<size_t> &nacn, unsigned threads)
+{
+	nclasses = nfa.char_classes(ec);
+	vector<size_t> represent(nclasses, -1); // The smallest byte of each class
+	for (size_t b = 255; b != (size_t)-1; --b)
+	{
+		represent[ec[b]] = b;
+	}
+	if (threads > 1)
+	{
+		build_parallel(nfa, nacn, represent, threads);
+		return;
+	}
+
+	StateSetTable Dstates; // Each state of the DFA corresponds to a set of states of the NFA
+	stack<size_t> unFlaged; // Unmarked DFA status
+	SparseSet scratch(nfa.get_size());
+	vector<uint32_t> T, U;
+
+	Dstates.intern(nfa.epsilon_closure(0)); // Dstates started with epsilon-closure(s0)
+	add_state();							 // Add a state to Dtran
+	unFlaged.push(0);						 // And not marked
+	counters.closureCalls = 1;
+	counters.internLookups = 1;
+
+	while (!unFlaged.empty())
+	{
+		size_t Tidx = unFlaged.top(); // Retrieves an unmarked DFA state
+		unFlaged.pop();
+		T.assign(Dstates.begin(Tidx), Dstates.end(Tidx)); // The corresponding set of NFA states
+		for (size_t c = 1; c < nclasses; ++c)
+		{ // Class 0 has no transitions
+			nfa.move_closure(T.data(), T.data() + T.size(), represent[c], scratch, U);
+			++counters.closureCalls;
+			if (!U.empty())
+			{ // There is a conversion
+				// Because the results of the functions that evaluate epsilon
+				// closures are all sorted, equal sets have equal hashes
+				pair<size_t, bool> Uidx = Dstates.intern(U);
+				++counters.internLookups;
+				counters.internHits += !Uidx.second;
+				if (Uidx.second)
+				{							   // U was not in Dstates
+					add_state();			   // Add a state to Dtran
+					unFlaged.push(Uidx.first); // And not marked
+				}
+				Dtran[Tidx * nclasses + c] = Uidx.first;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < Dstates.get_size(); ++i)
+	{ // Determine whether the DFA status is accepted
+		// Takes the first listed pattern corresponding to the accepted state
+		accepts.push_back(first_accept(Dstates.begin(i), Dstates.end(i), nacn));
+	}
+}
+
+// Parallel subset construction: the workers take unmarked DFA states from a shared frontier,
+// compute the successors on every class independently, and intern them in a concurrent table.
+// Every worker keeps the rows it computed, and they are put together at the end
+void DFA::build_parallel(const NFA &nfa, const vector<size_t> &nacn, const vector<size_t> &represent, unsigned threads)
+{
+	struct Work
+	{ // An unmarked DFA state and its set of NFA states
+		size_t idx;
+		vector<uint32_t> set;
+	};
+	struct Row
+	{ // A row of Dtran computed by a worker
+		size_t idx;
+		size_t accept;
+		vector<size_t> targets;
+	};
+	ConcurrentStateSetTable Dstates;
+	deque<Work> frontier; // Unmarked DFA states
+	size_t pending = 1;	  // States in the frontier or being processed
+	mutex frontierLock;
+	condition_variable frontierCv;
+	vector<vector<Row>> rows(threads);
+
+	Work start;
+	start.set = nfa.epsilon_closure(0);
+	start.idx = Dstates.intern(start.set).first;
+	frontier.push_back(start);
+
+	counters.closureCalls = 1;
+	counters.internLookups = 1;
+	auto worker = [&](unsigned w)
+	{
+		SparseSet scratch(nfa.get_size());
+		vector<uint32_t> U;
+		vector<Work> found;
+		BuildCounters local; // Added to counters when the worker is done
+		for (;;)
+		{
+			Work job;
+			{
+				unique_lock<mutex> guard(frontierLock);
+				frontierCv.wait(guard, [&]() { return !frontier.empty() || pending == 0; });
+				if (frontier.empty())
+				{ // pending == 0: every state is marked
+					counters.closureCalls += local.closureCalls;
+					counters.internLookups += local.internLookups;
+					counters.internHits += local.internHits;
+					return;
+				}
+				job = std::move(frontier.front());
+				frontier.pop_front();
+			}
+			Row row;
+			row.idx = job.idx;
+			row.accept = first_accept(job.set.data(), job.set.data() + job.set.size(), nacn);
+			row.targets.assign(nclasses, -1);
+			found.clear();
+			for (size_t c = 1; c < nclasses; ++c)
+			{
+				nfa.move_closure(job.set.data(), job.set.data() + job.set.size(), represent[c], scratch, U);
+				++local.closureCalls;
+				if (!U.empty())
+				{
+					pair<size_t, bool> Uidx = Dstates.intern(U);
+					++local.internLookups;
+					local.internHits += !Uidx.second;
+					if (Uidx.second)
+					{
+						found.push_back(Work{Uidx.first, U});
+					}
+					row.targets[c] = Uidx.first;
+				}
+			}
+			rows[w].push_back(std::move(row));
+			bool done;
+			{
+				lock_guard<mutex> guard(frontierLock);
+				for (Work &f : found)
+				{
+					frontier.push_back(std::move(f));
+				}
+				pending += found.size();
+				done = --pending == 0;
+			}
+			if (done || found.size() > 0)
+			{
+				frontierCv.notify_all();
+			}
+		}
+	};
+	vector<thread> pool;
+	for (unsigned w = 1; w < threads; ++w)
+	{
+		pool.push_back(thread(worker, w));
+	}
+	worker(0);
+	for (auto &th : pool)
+	{
+		th.join();
+	}
+
+	Dtran.assign(Dstates.get_size() * nclasses, -1);
+	accepts.assign(Dstates.get_size(), -1);
+	for (const auto &rs : rows)
+	{
+		for (const Row &r : rs)
+		{
+			copy(r.targets.begin(), r.targets.end(), Dtran.begin() + r.idx * nclasses);
+			accepts[r.idx] = r.accept;
+		}
+	}
+}
+
+// Build the DFA directly from the syntax tree: each DFA state is a set of positions,
+// and the successor on a class is the union of followpos of the positions matching it
+DFA::DFA(const RegexTree &tree)
+{
+	nclasses = tree.char_classes(ec);
+	vector<size_t> represent(nclasses, -1); // The smallest byte of each class
+	for (size_t b = 255; b != (size_t)-1; --b)
+	{
+		represent[ec[b]] = b;
+	}
+	vector<vector<size_t>> posClasses(tree.get_positions()); // The classes each position matches
+	for (size_t p = 0; p < tree.get_positions(); ++p)
+	{
+		for (size_t c = 1; c < nclasses; ++c)
+		{
+			if (tree.get_label(p).test(represent[c]))
+			{
+				posClasses[p].push_back(c);
+			}
+		}
+	}
+
+	StateSetTable Dstates;			 // Each state of the DFA corresponds to a set of positions
+	stack<size_t> unFlaged;			 // Unmarked DFA status
+	vector<vector<uint32_t>> U(nclasses); // Successors on each class
+	vector<uint32_t> T;
+
+	Dstates.intern(tree.get_start());
+	add_state();
+	unFlaged.push(0);
+	counters.internLookups = 1;
+
+	while (!unFlaged.empty())
+	{
+		size_t Tidx = unFlaged.top();
+		unFlaged.pop();
+		T.assign(Dstates.begin(Tidx), Dstates.end(Tidx));
+		for (uint32_t p : T)
+		{
+			const vector<uint32_t> &fp = tree.get_followpos(p);
+			for (size_t c : posClasses[p])
+			{
+				U[c].insert(U[c].end(), fp.begin(), fp.end());
+			}
+		}
+		for (size_t c = 1; c < nclasses; ++c)
+		{
+			if (!U[c].empty())
+			{
+				sort(U[c].begin(), U[c].end());
+				U[c].erase(unique(U[c].begin(), U[c].end()), U[c].end());
+				pair<size_t, bool> Uidx = Dstates.intern(U[c]);
+				++counters.internLookups;
+				counters.internHits += !Uidx.second;
+				if (Uidx.second)
+				{
+					add_state();
+					unFlaged.push(Uidx.first);
+				}
+				Dtran[Tidx * nclasses + c] = Uidx.first;
+				U[c].clear();
+			}
+		}
+	}
+
+	for (size_t i = 0; i < Dstates.get_size(); ++i)
+	{							 // The accepted state contains the end marker of a rule
+		size_t firstAccept = -1; // Takes the first listed pattern
+		for (const uint32_t *p = Dstates.begin(i); p != Dstates.end(i); ++p)
+		{
+			firstAccept = tree.get_accept(*p) < firstAccept ? tree.get_accept(*p) : firstAccept;
+		}
+		accepts.push_back(firstAccept);
+	}
+}
+
+// Number of transitions (entries of Dtran other than -1)
+size_t DFA::get_num_edges() const
+{
+	return Dtran.size() - count(Dtran.begin(), Dtran.end(), (size_t)-1);
+}
+
+// minimize DFA (Hopcroft's partition refinement)
+// The -1 entries of Dtran are treated as transitions to an implicit dead state,
+// which makes the DFA complete. States equivalent to the dead state become -1 again.
+void DFA::minimize() {
+	const size_t n = get_size() + 1;		// All states plus the dead state
+	const size_t dead = n - 1;
+	const size_t k = nclasses;
+
+	// Inverse transitions, grouped by (character class, target state)
+	vector<size_t> invStart(k * n + 1, 0);
+	vector<size_t> inv(k * n);
+	for (size_t s = 0; s < n; ++s) {
+		for (size_t c = 0; c < k; ++c) {
+			size_t t = (s == dead || get_tran(s, c) == (size_t)-1) ? dead : get_tran(s, c);
+			++invStart[c * n + t + 1];
+		}
+	}
+	for (size_t i = 1; i < invStart.size(); ++i) {
+		invStart[i] += invStart[i - 1];
+	}
+	{
+		vector<size_t> fill(invStart.begin(), invStart.end() - 1);
+		for (size_t s = 0; s < n; ++s) {
+			for (size_t c = 0; c < k; ++c) {
+				size_t t = (s == dead || get_tran(s, c) == (size_t)-1) ? dead : get_tran(s, c);
+				inv[fill[c * n + t]++] = s;
+			}
+		}
+	}
+
+	// Partition: the states of block b are elems[bFirst[b], bEnd[b]),
+	// and the first bMarked[b] of them are marked in the current round
+	vector<size_t> elems(n), loc(n), sttGroup(n);
+	vector<size_t> bFirst, bEnd, bMarked;
+
+	// Initial partition: one group per accepted pattern, so that states accepting
+	// different patterns are never merged, and one group for all other states
+	map<size_t, size_t> accToGroup;
+	for (size_t s = 0; s < n; ++s) {
+		size_t acc = s == dead ? (size_t)-1 : accepts[s];
+		if (!accToGroup.count(acc)) {
+			accToGroup.insert(pair<size_t, size_t>(acc, accToGroup.size()));
+		}
+		sttGroup[s] = accToGroup.at(acc);
+	}
+	bFirst.assign(accToGroup.size(), 0);
+	bEnd.assign(accToGroup.size(), 0);
+	bMarked.assign(accToGroup.size(), 0);
+	for (size_t s = 0; s < n; ++s) {
+		++bEnd[sttGroup[s]];
+	}
+	for (size_t b = 1; b < bEnd.size(); ++b) {
+		bEnd[b] += bEnd[b - 1];
+	}
+	for (size_t b = 0; b < bEnd.size(); ++b) {
+		bFirst[b] = b == 0 ? 0 : bEnd[b - 1];
+	}
+	{
+		vector<size_t> fill(bFirst);
+		for (size_t s = 0; s < n; ++s) {
+			loc[s] = fill[sttGroup[s]]++;
+			elems[loc[s]] = s;
+		}
+	}
+
+	// Worklist of splitters (group, class). Initially all groups but the largest one.
+	vector<pair<size_t, size_t>> waiting;
+	size_t largest = 0;
+	for (size_t b = 1; b < bEnd.size(); ++b) {
+		if (bEnd[b] - bFirst[b] > bEnd[largest] - bFirst[largest]) {
+			largest = b;
+		}
+	}
+	for (size_t b = 0; b < bEnd.size(); ++b) {
+		if (b != largest) {
+			for (size_t c = 0; c < k; ++c) {
+				waiting.push_back(pair<size_t, size_t>(b, c));
+			}
+		}
+	}
+
+	vector<size_t> splitter;			// States of the current splitter
+	vector<size_t> touched;				// Groups that have marked states
+	while (!waiting.empty()) {
+		size_t B = waiting.back().first;
+		size_t c = waiting.back().second;
+		waiting.pop_back();
+
+		splitter.assign(elems.begin() + bFirst[B], elems.begin() + bEnd[B]);
+		touched.clear();
+		for (size_t t : splitter) {		// Mark every state that moves into B on c
+			for (size_t j = invStart[c * n + t]; j < invStart[c * n + t + 1]; ++j) {
+				size_t s = inv[j];
+				size_t g = sttGroup[s];
+				size_t pos = bFirst[g] + bMarked[g];
+				if (loc[s] < pos) {			// Already marked
+					continue;
+				}
+				if (bMarked[g] == 0) {
+					touched.push_back(g);
+				}
+				size_t other = elems[pos];	// Swap s into the marked prefix of its group
+				elems[pos] = s;
+				elems[loc[s]] = other;
+				loc[other] = loc[s];
+				loc[s] = pos;
+				++bMarked[g];
+			}
+		}
+
+		for (size_t g : touched) {
+			size_t marked = bMarked[g];
+			bMarked[g] = 0;
+			size_t size = bEnd[g] - bFirst[g];
+			if (marked == size) {			// The whole group moves into B, no split
+				continue;
+			}
+			// Split g: the smaller part becomes the new group
+			size_t ng = bFirst.size();
+			if (marked <= size - marked) {
+				bFirst.push_back(bFirst[g]);
+				bEnd.push_back(bFirst[g] + marked);
+				bFirst[g] += marked;
+			}
+			else {
+				bFirst.push_back(bFirst[g] + marked);
+				bEnd.push_back(bEnd[g]);
+				bEnd[g] = bFirst[g] + marked;
+			}
+			bMarked.push_back(0);
+			for (size_t i = bFirst[ng]; i < bEnd[ng]; ++i) {
+				sttGroup[elems[i]] = ng;
+			}
+			// Whether or not (g, a) is waiting, adding the smaller half is enough
+			for (size_t a = 0; a < k; ++a) {
+				waiting.push_back(pair<size_t, size_t>(ng, a));
+			}
+		}
+	}
+
+	// Number the groups in breadth-first order from the group of the start state, so that
+	// equal automata get equal tables whatever engine built them.
+	// The group of the dead state is dropped (back to -1)
+	vector<size_t> newIdx(bFirst.size(), -1);
+	vector<size_t> represent;			// A state of each new group
+	newIdx[sttGroup[dead]] = -2;
+	newIdx[sttGroup[0]] = 0;
+	represent.push_back(0);
+	for (size_t i = 0; i < represent.size(); ++i) {
+		for (size_t c = 0; c < k; ++c) {
+			size_t t = get_tran(represent[i], c);
+			if (t != (size_t)-1 && newIdx[sttGroup[t]] == (size_t)-1) {
+				newIdx[sttGroup[t]] = represent.size();
+				represent.push_back(t);
+			}
+		}
+	}
+	newIdx[sttGroup[dead]] = -1;
+
+	vector<size_t> newDtran;
+	vector<size_t> newAccepts;
+	for (size_t s : represent) {
+		for (size_t c = 0; c < k; ++c) {
+			size_t t = get_tran(s, c);
+			newDtran.push_back(t == (size_t)-1 ? t : newIdx[sttGroup[t]]);
+		}
+		newAccepts.push_back(accepts[s]);
+	}
+	Dtran.swap(newDtran);
+	accepts.swap(newAccepts);
+}
+
+// Delete dead state
+// Remove the states that are unreachable from the start state or cannot reach an accept state:
+// A scan that enters a dead state can never accept again, so its transitions are
+// redirected to -1 (the jam state) and the lexer stops at the first byte of a dead prefix.
+// The remaining states are renumbered densely, in their old order (the start state stays 0)
+void DFA::delete_dead_states() {
+	const size_t n = get_size();
+	const size_t k = nclasses;
+
+	// Forward pass: reachable from the start state
+	vector<bool> reachable(n, false);
+	vector<size_t> stk(1, 0);
+	reachable[0] = true;
+	while (!stk.empty()) {
+		size_t s = stk.back();
+		stk.pop_back();
+		for (size_t c = 0; c < k; ++c) {
+			size_t t = get_tran(s, c);
+			if (t != (size_t)-1 && !reachable[t]) {
+				reachable[t] = true;
+				stk.push_back(t);
+			}
+		}
+	}
+
+	// Reverse pass: reaches an accept state, over the inverse transitions
+	vector<size_t> invStart(n + 1, 0);
+	vector<size_t> inv;
+	for (size_t s = 0; s < n; ++s) {
+		for (size_t c = 0; c < k; ++c) {
+			if (get_tran(s, c) != (size_t)-1) {
+				++invStart[get_tran(s, c) + 1];
+			}
+		}
+	}
+	for (size_t i = 1; i <= n; ++i) {
+		invStart[i] += invStart[i - 1];
+	}
+	inv.resize(invStart[n]);
+	{
+		vector<size_t> fill(invStart.begin(), invStart.end() - 1);
+		for (size_t s = 0; s < n; ++s) {
+			for (size_t c = 0; c < k; ++c) {
+				if (get_tran(s, c) != (size_t)-1) {
+					inv[fill[get_tran(s, c)]++] = s;
+				}
+			}
+		}
+	}
+	vector<bool> live(n, false);
+	for (size_t s = 0; s < n; ++s) {
+		if (accepts[s] != (size_t)-1) {
+			live[s] = true;
+			stk.push_back(s);
+		}
+	}
+	while (!stk.empty()) {
+		size_t t = stk.back();
+		stk.pop_back();
+		for (size_t j = invStart[t]; j < invStart[t + 1]; ++j) {
+			if (!live[inv[j]]) {
+				live[inv[j]] = true;
+				stk.push_back(inv[j]);
+			}
+		}
+	}
+
+	// Keep the useful states; the start state is kept even if no rule can match
+	vector<size_t> newIdx(n, -1);
+	size_t m = 0;
+	for (size_t s = 0; s < n; ++s) {
+		if (s == 0 || (reachable[s] && live[s])) {
+			newIdx[s] = m++;
+		}
+	}
+	if (m == n) {
+		return;
+	}
+	vector<size_t> newDtran;
+	vector<size_t> newAccepts;
+	newDtran.reserve(m * k);
+	for (size_t s = 0; s < n; ++s) {
+		if (newIdx[s] == (size_t)-1) {
+			continue;
+		}
+		for (size_t c = 0; c < k; ++c) {
+			size_t t = get_tran(s, c);
+			newDtran.push_back(t == (size_t)-1 ? t : newIdx[t]);
+		}
+		newAccepts.push_back(accepts[s]);
+	}
+	Dtran.swap(newDtran);
+	accepts.swap(newAccepts);
+}
+
+// Compiled DFA file: magic, key, the length and the text of the rules, sizes, then ec, Dtran and
+// accepts as 32-bit words (-1 is 0xffffffff)
+const char DFA_FILE_MAGIC[8] = {'S', 'E', 'U', 'L', 'E', 'X', 'D', '1'};
+
+inline void write_u32(ostream &os, uint32_t v)
+{
+	os.write((const char *)&v, sizeof(v));
+}
+inline uint32_t read_u32(istream &is)
+{
+	uint32_t v = 0;
+	is.read((char *)&v, sizeof(v));
+	return v;
+}
+
+// Write the DFA of the rules (as rules_text gives them) to a compiled DFA file
+bool DFA::save(ostream &os, uint64_t key, const string &rules) const {
+	os.write(DFA_FILE_MAGIC, sizeof(DFA_FILE_MAGIC));
+	os.write((const char *)&key, sizeof(key));
+	write_u32(os, (uint32_t)rules.size());
+	os.write(rules.data(), rules.size());
+	write_u32(os, nclasses);
+	write_u32(os, get_size());
+	for (size_t b = 0; b < 256; ++b) {
+		os.put((char)ec[b]);
+	}
+	for (size_t t : Dtran) {
+		write_u32(os, (uint32_t)t);
+	}
+	for (size_t a : accepts) {
+		write_u32(os, (uint32_t)a);
+	}
+	return (bool)os;
+}
+
+// Read the DFA from a compiled DFA file, fails if the file was written with another key or
+// for other rules (whose key is the same only by a collision of the hash), or if it does not
+// hold a DFA of nrules rules: a corrupt file is a cache miss, not a lexer that indexes its tables
+// out of range
+bool DFA::load(istream &is, uint64_t key, const string &rules, size_t nrules) {
+	char magic[sizeof(DFA_FILE_MAGIC)];
+	uint64_t fileKey = 0;
+	is.read(magic, sizeof(magic));
+	is.read((char *)&fileKey, sizeof(fileKey));
+	if (!is || !equal(magic, magic + sizeof(magic), DFA_FILE_MAGIC) || fileKey != key ||
+		read_u32(is) != rules.size()) {
+		return false;
+	}
+	for (char ch : rules) {
+		if (is.get() != (unsigned char)ch) {
+			return false;
+		}
+	}
+	nclasses = read_u32(is);
+	size_t size = read_u32(is);
+	if (!is || nclasses == 0 || nclasses > 257 || size == 0) {
+		return false;
+	}
+	// The rest of the file must be the classes, the transitions and the accepted rules, which
+	// bounds size before anything is allocated
+	streampos pos = is.tellg();
+	is.seekg(0, ios::end);
+	streamoff rest = is.tellg() - pos;
+	is.seekg(pos);
+	if (!is || (uint64_t)rest != 256 + 4 * ((uint64_t)size * nclasses + size)) {
+		return false;
+	}
+	for (size_t b = 0; b < 256; ++b) {
+		ec[b] = (unsigned char)is.get();
+		if (ec[b] >= nclasses) {
+			return false;
+		}
+	}
+	Dtran.resize(size * nclasses);
+	for (size_t &t : Dtran) {
+		uint32_t v = read_u32(is);
+		if (v != 0xffffffffu && v >= size) {
+			return false;
+		}
+		t = v == 0xffffffffu ? (size_t)-1 : v;
+	}
+	accepts.resize(size);
+	for (size_t &a : accepts) {
+		uint32_t v = read_u32(is);
+		if (v != 0xffffffffu && v >= nrules) {
+			return false;
+		}
+		a = v == 0xffffffffu ? (size_t)-1 : v;
+	}
+	return (bool)is;
+}
+
+// Determine whether ch is a character that must be escaped in a regular expression
+// Regular expressions use the backslash character ('\') to indicate special forms or
+// to allow special characters to be used without invoking their special meaning.
+// For example, In lex files, the backslash followed by a question mark (?) is typically
+// used to match a literal question mark character (?).
+inline bool need_escape(char ch)
+{
+	if (ch == '\\' || ch == '\"' || ch == '.' || ch == '^' || ch == '$' || ch == '[' || ch == ']' || ch == '*' || ch == '+' || ch == '?' || ch == '{' || ch == '}' || ch == '|' || ch == '/' || ch == '(' || ch == ')')
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+// Determines whether it is an operator, i.e. a backslash that
+// previously had no real meaning (an even number of consecutive backslashes)
+inline bool is_not_escaped(string::const_iterator it, const string &str)
+{
+	if (it == str.begin())
+	{
+		return true;
+	}
+	else
+	{
+		it--;
+		int backSlashCount = 0;
+		for (; it != str.begin(); --it)
+		{
+			if (*it == '\\')
+			{
+				++backSlashCount;
+			}
+			else
+			{
+				break;
+			}
+		}
+		if (backSlashCount % 2 == 0)
+		{
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+}
+
+// Analyzes two parts of a line separated by tabs.
+pair<string, string> split_by_blank(const string &str)
+{
+	bool flag = true;
+	string name, expr;
+	for (auto c : str)
+	{
+		if (flag)
+		{
+			if (c != '\t')
+			{
+				name.push_back(c);
+			}
+			else
+			{
+				flag = false;
+			}
+		}
+		else
+		{
+			if (c != '\t')
+			{
+				expr.push_back(c);
+			}
+			else
+			{
+				if (expr.empty())
+					continue;
+				else
+					break;
+			}
+		}
+	}
+	return pair<string, string>(name, expr);
+}
+
+// "." is just a point
+// . is a operator
+
+// Parses a regular expression string into a sequence of symbols and handles parentheses and quotes
+// A bracket expression becomes a single character set operand, stored in charSets
+vector<int> deal_brkt_qt(const string &exp, vector<CharSet> &charSets)
+{
+
+	vector<int> res;
+	string inBracket;			 // The actual character in the bracket([])
+	bool bracketFlag = false;	 // Detection bracket
+	bool notBracketFlag = false; // Detection bracket（Complement form）
+	bool quotationFlag = false;	 // Detection quotes
+
+	// const_iterator
+	// dereferencing converts the value returned by the underlying iterator as immutable.
+	for (string::const_iterator it = exp.begin(); it != exp.end(); ++it)
+	{
+		// Enter quotes, and inside brackets do not count
+		if (!quotationFlag && !bracketFlag && !notBracketFlag && *it == '\"' && is_not_escaped(it, exp))
 		{
-			bracketFlag = false;
-			res.push_back(to_operator('('));
-			bool first = true;
+			quotationFlag = true;
+		}
+		// End of quote
+		else if (quotationFlag && !bracketFlag && !notBracketFlag && *it == '\"' && is_not_escaped(it, exp))
+		{
+			quotationFlag = false;
+		}
+		// Inside quotation("") marks
+		else if (quotationFlag)
+		{
+			res.push_back(*it);
+		}
+		// enter bracket ([]).
+		else if (!bracketFlag && !notBracketFlag && *it == '[' && is_not_escaped(it, exp))
+		{
+			// the caret symbol (^)
+			// This operator is used to match any character
+			// except the ones specified following the caret.
+			if (*(it + 1) != '^')
+			{
+				bracketFlag = true;
+			}
+			else
+			{
+				++it;
+				notBracketFlag = true;
+			}
+			inBracket.clear();
+		}
+		// End of bracket (or its complement form)
+		else if ((bracketFlag || notBracketFlag) && *it == ']' && is_not_escaped(it, exp))
+		{
+			CharSet members;
 			for (auto c = inBracket.begin(); c != inBracket.end(); ++c)
 			{
-				if (first)
-				{ // Add | between all but the first
-					first = false;
+				if (*c == '\\')
+				{ // If it is escaped, the escaped symbol is viewed as a whole
+					if (need_escape(*(++c)))
+					{
+						members.set((size_t)(*c));
+					}
+					else
+					{
+						switch (*c)
+						{
+						case 'a':
+							members.set((size_t)'\a'); // alert (bell) character.
+							break;
+						case 'b':
+							members.set((size_t)'\b'); // backspace character
+							break;
+						case 'f':
+							members.set((size_t)'\f'); // feed character
+							break;
+						case 'n':
+							members.set((size_t)'\n'); // newline character
+							break;
+						case 'r':
+							members.set((size_t)'\r'); // carriage return character
+							break;
+						case 't':
+							members.set((size_t)'\t'); // horizontal tab character
+							break;
+						case 'v':
+							members.set((size_t)'\v'); // vertical tab character
+							break;
+						}
+					}
+				}
+				else
+				{
+					members.set((size_t)(*c));
+				}
+			}
+			if (notBracketFlag)
+			{ // Calculation of the complement
+				members.flip();
+			}
+			members.reset(0); // NUL ends the input, no rule matches it
+			bracketFlag = false;
+			notBracketFlag = false;
+			res.push_back(CHARSET_BASE + (int)charSets.size());
+			charSets.push_back(members);
+		}
+		// Inside the brackets, fill into the inBracket.
+		else if (bracketFlag || notBracketFlag)
+		{
+			if (*it != '-' || *(it + 1) == ']')
+			{
+				inBracket.push_back(*it);
+			}
+			else
+			{ // 0-9 => from 0 to 9.
+				// *(it - 1) has been in inBracket.
+				for (char ch = *(it - 1) + 1; ch < *(it + 1); ++ch)
+				{
+					inBracket.push_back(ch);
+				}
+			}
+		}
+		else
+		{
+			if (*it == '\\')
+			{
+				if (need_escape(*(++it)))
+				{
+					res.push_back(*it);
+				}
+				else
+				{
+					switch (*it)
+					{
+					case 'a':
+						res.push_back('\a');
+						break;
+					case 'b':
+						res.push_back('\b');
+						break;
+					case 'f':
+						res.push_back('\f');
+						break;
+					case 'n':
+						res.push_back('\n');
+						break;
+					case 'r':
+						res.push_back('\r');
+						break;
+					case 't':
+						res.push_back('\t');
+						break;
+					case 'v':
+						res.push_back('\v');
+						break;
+					}
+				}
+			}
+			else
+			{
+				if (need_escape(*it))
+				{
+					res.push_back(to_operator(*it));
+				}
+				else
+				{
+					res.push_back(*it);
+				}
+			}
+		}
+	}
+	return res;
+}
+
+// Replace each use {name} of a regular definition by its operand, DEF_BASE + its number in the map
+vector<int> ref_defs(const vector<int> &rgx, const map<string, size_t> &mp)
+{
+	vector<int> res;
+	bool braceFlag = false;
+	string defName; // The used regular defines symbols
+	for (vector<int>::const_iterator it = rgx.begin(); it != rgx.end(); ++it)
+	{
+		if (*it == to_operator('{') && !braceFlag)
+		{
+			braceFlag = true;
+			defName.clear();
+		}
+		else if (*it == to_operator('}') && braceFlag)
+		{
+			braceFlag = false;
+			if (mp.count(defName) == 0)
+			{
+			} // Maybe an error?
+			else
+			{
+				res.push_back(DEF_BASE + (int)mp.at(defName));
+			}
+		}
+		else if (braceFlag)
+		{
+			defName.push_back((char)*it);
+		}
+		else
+		{
+			res.push_back(*it);
+		}
+	}
+	return res;
+}
+
+//
+
+// Processing point
+// Every dot becomes one character set operand
+vector<int> deal_dot(const vector<int> &seq, vector<CharSet> &charSets)
+{
+	vector<int> res;
+	int dotSet = -1; // All dots share one set
+	for (vector<int>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	{
+		// (Dot.) In the default mode, this matches any character except a newline.
+		if (*it == to_operator('.'))
+		{
+			if (dotSet == -1)
+			{
+				CharSet all;
+				all.set();
+				all.reset((size_t)'\n');
+				all.reset(0); // NUL ends the input, no rule matches it
+				dotSet = CHARSET_BASE + (int)charSets.size();
+				charSets.push_back(all);
+			}
+			res.push_back(dotSet);
+		}
+		else
+		{
+			res.push_back(*it);
+		}
+	}
+	return res;
+}
+
+// /* => /&*
+// struct => s&t&r&u&c&t
+// 0(x|X)((a-fA-F0-9))+(((u|U)|(u|U)?(l|L|ll|LL)|(l|L|ll|LL)(u|U)))? =>
+// 0&(x|X)&((a-fA-F0-9))+&(((u|U)|(u|U)?&(l|L|l&l|L&L)|(l|L|l&l|L&L)&(u|U)))?
+
+// Add a connector (to operator('&'), in the form of an operator)
+vector<int> seq_to_infix(const vector<int> &seq)
+{
+	vector<int> res;
+	bool pre = false;
+	for (vector<int>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	{
+		if (pre)
+		{
+			if (!is_optr(*it) || to_char(*it) == '(')
+			{
+				res.push_back(to_operator('&'));
+				res.push_back(*it);
+			}
+			else
+			{
+				res.push_back(*it);
+			}
+		}
+		else
+		{
+			res.push_back(*it);
+		}
+		if (!is_optr(*it) || to_char(*it) == ')' || to_char(*it) == '*' || to_char(*it) == '+' || to_char(*it) == '?')
+		{
+			pre = true;
+		}
+		else
+		{
+			pre = false;
+		}
+	}
+	return res;
+}
+
+// 0&(x|X)&((a-fA-F0-9))+&(((u|U)|(u|U)?&(l|L|l&l|L&L)|(l|L|l&l|L&L)&(u|U)))? =>
+// 0xX|&ab|c|d|e|f|A|B|C|D|E|F|0|1|2|3|4|5|6|7|8|9|+&uU|uU|?lL|ll&|LL&|&|lL|ll&|LL&|uU|&|?&
+
+// Converts an infix regular expression to a suffix regular expression
+vector<int> infix_to_suffix(const vector<int> &seq)
+{
+	vector<int> res;
+	stack<int> optrStk;
+	map<char, int> priority{
+		{'*', 7},
+		{'+', 7},
+		{'?', 7},
+		{'&', 5},
+		{'|', 3}};
+	for (vector<int>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	{
+		if (!is_optr(*it))
+		{
+			res.push_back(*it);
+		}
+		else
+		{
+			if (*it == to_operator('('))
+			{
+				optrStk.push(*it);
+			}
+			else if (*it == to_operator(')'))
+			{
+				while (!optrStk.empty() && to_char(optrStk.top()) != '(')
+				{
+					res.push_back(optrStk.top());
+					optrStk.pop();
+				}
+				if (!optrStk.empty())
+				{
+					optrStk.pop();
+				}
+			}
+			else
+			{
+				if (optrStk.empty() || to_char(optrStk.top()) == '(')
+				{
+					optrStk.push(*it);
 				}
 				else
 				{
-					res.push_back(to_operator('|'));
-				}
-				if (*c == '\\')
-				{ // If it is escaped, the escaped symbol is viewed as a whole
-					if (need_escape(*(++c)))
+					if (priority[to_char(*it)] > priority[to_char(optrStk.top())])
 					{
-						res.push_back(*c);
+						optrStk.push(*it);
 					}
 					else
 					{
-						switch (*c)
+						while (!optrStk.empty() && priority[to_char(*it)] <= priority[to_char(optrStk.top())])
 						{
-						case 'a':
-							res.push_back('\a'); // alert (bell) character.
-							break;
-						case 'b':
-							res.push_back('\b'); // backspace character
-							break;
-						case 'f':
-							res.push_back('\f'); // feed character
-							break;
-						case 'n':
-							res.push_back('\n'); // newline character
-							break;
-						case 'r':
-							res.push_back('\r'); // carriage return character
-							break;
-						case 't':
-							res.push_back('\t'); // horizontal tab character
-							break;
-						case 'v':
-							res.push_back('\v'); // vertical tab character
-							break;
+							res.push_back(optrStk.top());
+							optrStk.pop();
 						}
+						optrStk.push(*it);
 					}
 				}
-				else
+			}
+		}
+	}
+	while (!optrStk.empty())
+	{
+		res.push_back(optrStk.top());
+		optrStk.pop();
+	}
+	return res;
+}
+
+// Thompson construction of the tree that a DAG node stands for, in nfa: the shared nodes below
+// it are copied from their templates instead of walking their subtrees again.
+// setLabel is the label in nfa of each character set of the DAG, -1 until it is added
+NFA::Frag dag_to_frag(NFA &nfa, const RegexDag &dag, uint32_t root, const vector<bool> &shared,
+					  const vector<NFA::Template> &templates, vector<uint32_t> &setLabel)
+{
+	vector<NFA::Frag> s;
+	vector<uint32_t> order;
+	if (shared[root] && templates[root].nstates)
+	{ // The whole tree is copied
+		order.push_back(root);
+	}
+	else
+	{
+		dag.expand(root, order, &shared);
+	}
+	for (uint32_t i : order)
+	{
+		const RegexDag::Node &nd = dag.get_node(i);
+		if (shared[i] && templates[i].nstates)
+		{
+			const NFA::Template &t = templates[i];
+			for (const NFA::Edge &e : t.edges)
+			{ // Add the sets in the order of the walk, as if the subtree was walked
+				if (e.label > 128 && setLabel[e.label - 129] == (uint32_t)-1)
+				{
+					setLabel[e.label - 129] = nfa.add_set(dag.get_set(e.label - 129));
+				}
+			}
+			s.push_back(nfa.opt_copy(t, setLabel));
+		}
+		else if (nd.op == 0 && is_charset(nd.sym))
+		{
+			uint32_t &label = setLabel[nd.sym - CHARSET_BASE];
+			if (label == (uint32_t)-1)
+			{
+				label = nfa.add_set(dag.get_set(nd.sym - CHARSET_BASE));
+			}
+			s.push_back(nfa.opt_label(label));
+		}
+		else if (nd.op == 0)
+		{
+			s.push_back(nfa.opt_label(nd.sym));
+		}
+		else if (nd.op == '|')
+		{
+			NFA::Frag rhs = s.back();
+			s.pop_back();
+			s.back() = nfa.opt_union(s.back(), rhs);
+		}
+		else if (nd.op == '&')
+		{
+			NFA::Frag rhs = s.back();
+			s.pop_back();
+			s.back() = nfa.opt_concat(s.back(), rhs);
+		}
+		else if (nd.op == '*')
+		{
+			s.back() = nfa.opt_star(s.back());
+		}
+		else if (nd.op == '+')
+		{
+			s.back() = nfa.opt_plus(s.back());
+		}
+		else if (nd.op == '?')
+		{
+			s.back() = nfa.opt_quest(s.back());
+		}
+	}
+	return s.back();
+}
+
+// The fragments of the shared nodes, each built once in an NFA of its own (with the set labels
+// of the DAG), in node order so that the children come first and are copied in turn
+vector<NFA::Template> nfa_templates(const RegexDag &dag, const vector<bool> &shared)
+{
+	vector<NFA::Template> templates(dag.get_size());
+	for (uint32_t i = 0; i < dag.get_size(); ++i)
+	{
+		if (!shared[i])
+		{
+			continue;
+		}
+		vector<uint32_t> setLabel(dag.get_num_sets());
+		for (size_t k = 0; k < setLabel.size(); ++k)
+		{
+			setLabel[k] = 129 + k;
+		}
+		NFA nfa;
+		NFA::Frag f = dag_to_frag(nfa, dag, i, shared, templates, setLabel);
+		templates[i] = nfa.save_template(f);
+	}
+	return templates;
+}
+
+// Convert a rule of the DAG to NFA
+NFA dag_to_nfa(const RegexDag &dag, uint32_t root, const vector<bool> &shared, const vector<NFA::Template> &templates)
+{
+	NFA nfa;
+	vector<uint32_t> setLabel(dag.get_num_sets(), -1); // Label of each character set used, added once
+	nfa.finish(dag_to_frag(nfa, dag, root, shared, templates, setLabel));
+	return nfa;
+}
+
+// Write a C array of integers, 16 per line
+void gen_array(ofstream &ofs, const string &decl, const vector<long long> &values)
+{
+	ofs << decl << " = {\n";
+	if (values.empty())
+	{ // C has no empty initializers
+		ofs << "\t0\n";
+	}
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		ofs << (i % 16 == 0 ? "\t" : "") << values[i] << (i + 1 != values.size() ? "," : "") << (i % 16 == 15 || i + 1 == values.size() ? '\n' : ' ');
+	}
+	ofs << "};\n\n";
+}
+
+// Parameters of a generated function, followed by the scanner in a reentrant scanner
+string scan_params(const LexOptions &opts, const string &params)
+{
+	if (opts.reentrant)
+	{
+		return params + (params.empty() ? "" : ", ") + "yyscan_t yyscanner";
+	}
+	return params.empty() ? "void" : params;
+}
+
+// A call of a generated function, passing the scanner along in a reentrant scanner
+string scan_call(const LexOptions &opts, const string &name, const string &args)
+{
+	return name + "(" + args + (opts.reentrant ? (args.empty() ? "yyscanner" : ", yyscanner") : "") + ")";
+}
+
+// The state of a reentrant scanner (--reentrant), in one struct per scanner instead of globals:
+// Each variable the scanner reads or writes is a member with the suffix _r (as in flex), and while
+// the generated functions are emitted, its name is a macro for the member of *yyscanner, so the
+// code of the scanners and the actions is the same as in the other mode. The tables stay global,
+// shared and read-only. The macros are undefined at the end (gen_scanner_end), so code outside
+// yylex reaches the members as yyscanner->line_r etc., and the token through yyget_text and
+// yyget_leng, which do not depend on --yytext
+vector<pair<string, string>> scanner_fields(const LexOptions &opts)
+{
+	vector<pair<string, string>> fields; // Declaration, name
+	fields.push_back(make_pair("char *p_r;", "p"));
+	fields.push_back(make_pair("int line_r;", "line"));
+	fields.push_back(make_pair("int column_r;", "column"));
+	fields.push_back(make_pair("void *yyextra_r;", "yyextra"));
+	if (opts.text == LexOptions::COPY_TEXT)
+	{
+		fields.push_back(make_pair("char yytext_r[256];", "yytext"));
+		fields.push_back(make_pair("int yytextlen_r;", "yytextlen"));
+	}
+	else
+	{
+		fields.push_back(make_pair("char *yy_text_ptr_r;", "yy_text_ptr"));
+		fields.push_back(make_pair("int yyleng_r;", "yyleng"));
+		fields.push_back(make_pair("char *yy_hold_pos_r;", "yy_hold_pos"));
+		fields.push_back(make_pair("char yy_hold_char_r;", "yy_hold_char"));
+	}
+	if (opts.input == LexOptions::STREAM_INPUT)
+	{
+		fields.push_back(make_pair("FILE *yyin_r;", "yyin"));
+		fields.push_back(make_pair("char *yy_buf_r;", "yy_buf"));
+		fields.push_back(make_pair("size_t yy_buf_cap_r;", "yy_buf_cap"));
+		fields.push_back(make_pair("int yy_eof_r;", "yy_eof"));
+	}
+	if (opts.input == LexOptions::MMAP_INPUT)
+	{
+		fields.push_back(make_pair("char *yy_map_r;", "yy_map"));
+		fields.push_back(make_pair("size_t yy_map_len_r;", "yy_map_len"));
+	}
+	if (opts.input != LexOptions::STRING_INPUT)
+	{
+		fields.push_back(make_pair("char *yy_buf_end_r;", "yy_buf_end"));
+	}
+	return fields;
+}
+
+void gen_scanner_begin(ofstream &ofs, const LexOptions &opts)
+{
+	if (!opts.reentrant)
+	{
+		return;
+	}
+	ofs << "#include <stdio.h>\n";
+	ofs << "#include <stdlib.h>\n";
+	ofs << "#define YY_REENTRANT 1\n";
+	ofs << "struct yy_scanner {\n";
+	for (const auto &f : scanner_fields(opts))
+	{
+		ofs << '\t' << f.first << '\n';
+	}
+	ofs << "};\n";
+	ofs << "typedef struct yy_scanner *yyscan_t;\n";
+	for (const auto &f : scanner_fields(opts))
+	{
+		ofs << "#define " << f.second << " (yyscanner->" << f.second << "_r)\n";
+	}
+	if (opts.text == LexOptions::POINTER_TEXT)
+	{
+		ofs << "#define yytext yy_text_ptr\n";
+		ofs << "#define yytextlen yyleng\n";
+	}
+	ofs << '\n';
+}
+
+void gen_scanner_end(ofstream &ofs, const LexOptions &opts)
+{
+	if (!opts.reentrant)
+	{
+		return;
+	}
+	for (const auto &f : scanner_fields(opts))
+	{
+		ofs << "#undef " << f.second << '\n';
+	}
+	if (opts.text == LexOptions::POINTER_TEXT)
+	{
+		ofs << "#undef yytext\n";
+		ofs << "#undef yytextlen\n";
+	}
+	ofs << '\n';
+	ofs << "/* Create a scanner, returns 0 on success (as in flex) */\n";
+	ofs << "int yylex_init(yyscan_t *scanner) {\n";
+	ofs << '\t' << "*scanner = (yyscan_t)calloc(1, sizeof(struct yy_scanner));\n";
+	ofs << '\t' << "if (!*scanner)\n";
+	ofs << '\t' << '\t' << "return 1;\n";
+	if (opts.input == LexOptions::STRING_INPUT)
+	{
+		ofs << '\t' << "(*scanner)->p_r = (char *)\"\";\n";
+	}
+	ofs << '\t' << "(*scanner)->line_r = 1;\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n\n";
+	ofs << "/* Free a scanner and what it holds */\n";
+	ofs << "int yylex_destroy(yyscan_t scanner) {\n";
+	if (opts.input == LexOptions::STREAM_INPUT)
+	{
+		ofs << '\t' << "free(scanner->yy_buf_r);\n";
+	}
+	if (opts.input == LexOptions::MMAP_INPUT)
+	{
+		ofs << '\t' << "yy_unmap_file(scanner);\n";
+	}
+	ofs << '\t' << "free(scanner);\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n\n";
+	const bool copy = opts.text == LexOptions::COPY_TEXT;
+	ofs << "/* The text and the length of the last token (as in flex) */\n";
+	ofs << "char *yyget_text(yyscan_t scanner) {\n";
+	ofs << '\t' << "return scanner->" << (copy ? "yytext_r" : "yy_text_ptr_r") << ";\n";
+	ofs << "}\n\n";
+	ofs << "int yyget_leng(yyscan_t scanner) {\n";
+	ofs << '\t' << "return scanner->" << (copy ? "yytextlen_r" : "yyleng_r") << ";\n";
+	ofs << "}\n\n";
+}
+
+// Declarations of the input: the scanners read the input at p, and yy_more_input() tells whether
+// any is left, after putting back the byte that YY_TEXT_NUL replaced (so the caller need not).
+// With --input=stream the input is read from yyin into a buffer through YY_INPUT (as in flex), and
+// [p, yy_buf_end) is followed by a NUL sentinel: it jams every state, and only when the scan jams at
+// the sentinel does it refill the buffer. The token being scanned is moved to the start of the
+// buffer first, so tokens may span reads. The buffer doubles when the token leaves no room for
+// YY_BUF_SIZE more bytes, and each read fills it, so a long token is moved O(1) times per byte.
+// With --input=mmap, yy_map_file maps a file and p scans it in place: the file is mapped over
+// a reservation one page longer, so the bytes after its end are zeros and the first of them is
+// the sentinel, without copying the file or writing to it. With either, the end is yy_buf_end,
+// so NUL bytes in the input are input like any other (no rule matches them)
+void gen_input_decls(ofstream &ofs, const LexOptions &opts)
+{
+	const bool re = opts.reentrant;
+	if (opts.input == LexOptions::STRING_INPUT)
+	{
+		ofs << (re ? "#define yy_more_input(s) (yy_text_restore(s), *(s)->p_r != '\\0')\n\n" : "#define yy_more_input() (yy_text_restore(), *p != '\\0')\n\n");
+		return;
+	}
+	if (opts.input == LexOptions::MMAP_INPUT)
+	{
+		ofs << "#include <fcntl.h>\n";
+		ofs << "#include <unistd.h>\n";
+		ofs << "#include <sys/mman.h>\n";
+		ofs << "#include <sys/stat.h>\n";
+		ofs << "#define YY_MMAP 1\n";
+		if (!re)
+		{
+			ofs << "static char *yy_map = 0;\n";
+			ofs << "static size_t yy_map_len = 0;\n";
+			ofs << "static char *yy_buf_end = 0;\n";
+		}
+		ofs << (re ? "#define yy_more_input(s) (yy_text_restore(s), (s)->p_r != (s)->yy_buf_end_r)\n" : "#define yy_more_input() (yy_text_restore(), p != yy_buf_end)\n");
+		ofs << "\n";
+		ofs << "/* Unmap the file mapped by yy_map_file */\n";
+		ofs << "void yy_unmap_file(" << scan_params(opts, "") << ") {\n";
+		ofs << '\t' << "if (yy_map)\n";
+		ofs << '\t' << '\t' << "munmap(yy_map, yy_map_len);\n";
+		ofs << '\t' << "yy_map = 0;\n";
+		ofs << '\t' << "p = yy_buf_end = 0;\n";
+		ofs << "}\n";
+		ofs << "\n";
+		ofs << "/* Map the file name and scan it from the start. Returns 0 if it can not be mapped */\n";
+		ofs << "int yy_map_file(" << scan_params(opts, "const char *name") << ") {\n";
+		ofs << '\t' << "struct stat st;\n";
+		ofs << '\t' << "size_t page = (size_t)sysconf(_SC_PAGESIZE);\n";
+		ofs << '\t' << "char *map;\n";
+		ofs << '\t' << "int fd = open(name, O_RDONLY);\n";
+		ofs << '\t' << scan_call(opts, "yy_unmap_file", "") << ";\n";
+		ofs << '\t' << "if (fd < 0)\n";
+		ofs << '\t' << '\t' << "return 0;\n";
+		ofs << '\t' << "if (fstat(fd, &st) != 0) {\n";
+		ofs << '\t' << '\t' << "close(fd);\n";
+		ofs << '\t' << '\t' << "return 0;\n";
+		ofs << '\t' << "}\n";
+		ofs << '\t' << "/* Zero pages, one more than the file, so a NUL follows the last byte */\n";
+		ofs << '\t' << "yy_map_len = ((size_t)st.st_size / page + 1) * page;\n";
+		ofs << '\t' << "map = (char *)mmap(0, yy_map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);\n";
+		ofs << '\t' << "if (map == MAP_FAILED) {\n";
+		ofs << '\t' << '\t' << "close(fd);\n";
+		ofs << '\t' << '\t' << "return 0;\n";
+		ofs << '\t' << "}\n";
+		ofs << '\t' << "/* Private, so that YY_TEXT_NUL writes only to copies of the pages */\n";
+		ofs << '\t' << "if (st.st_size > 0 && mmap(map, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {\n";
+		ofs << '\t' << '\t' << "munmap(map, yy_map_len);\n";
+		ofs << '\t' << '\t' << "close(fd);\n";
+		ofs << '\t' << '\t' << "return 0;\n";
+		ofs << '\t' << "}\n";
+		ofs << '\t' << "close(fd);\n";
+		ofs << '\t' << "madvise(map, yy_map_len, MADV_SEQUENTIAL);\n";
+		ofs << '\t' << "yy_map = p = map;\n";
+		ofs << '\t' << "yy_buf_end = map + st.st_size;\n";
+		ofs << '\t' << "return 1;\n";
+		ofs << "}\n\n";
+		return;
+	}
+	ofs << "#include <stdio.h>\n";
+	ofs << "#include <stdlib.h>\n";
+	ofs << "#include <string.h>\n";
+	ofs << "#define YY_STREAM 1\n";
+	ofs << "#ifndef YY_BUF_SIZE\n";
+	ofs << "#define YY_BUF_SIZE 16384\n";
+	ofs << "#endif\n";
+	ofs << "#ifndef YY_INPUT\n";
+	ofs << "#define YY_INPUT(buf, result, max_size) ((result) = (int)fread((buf), 1, (max_size), yyin))\n";
+	ofs << "#endif\n";
+	ofs << "#ifndef YY_FATAL_ERROR\n";
+	ofs << "#define YY_FATAL_ERROR(msg) (fprintf(stderr, \"%s\\n\", (msg)), exit(2))\n";
+	ofs << "#endif\n";
+	if (!re)
+	{
+		ofs << "FILE *yyin;\n";
+		ofs << "static char *yy_buf = 0;\n";
+		ofs << "static char *yy_buf_end = 0;\n";
+		ofs << "static size_t yy_buf_cap = 0;\n";
+		ofs << "static int yy_eof = 0;\n";
+	}
+	ofs << "\n";
+	ofs << "/* Keep [p, yy_buf_end) at the start of the buffer and read more input after it, moving\n";
+	ofs << "   forward and lastPos (if set) along. Returns 0 at the end of the input */\n";
+	ofs << "static int yy_refill(" << scan_params(opts, "char **forward, char **lastPos") << ") {\n";
+	ofs << '\t' << "size_t keep = yy_buf_end - p, fwd = *forward - p, last = *lastPos ? *lastPos - p : 0;\n";
+	ofs << '\t' << "int n = 0;\n";
+	ofs << '\t' << "if (yy_eof)\n";
+	ofs << '\t' << '\t' << "return 0;\n";
+	ofs << '\t' << "if (keep)\n";
+	ofs << '\t' << '\t' << "memmove(yy_buf, p, keep);\n";
+	ofs << '\t' << "if (keep + YY_BUF_SIZE + 1 > yy_buf_cap) {	/* Double it, or more */\n";
+	ofs << '\t' << '\t' << "size_t cap = yy_buf_cap * 2 > keep + YY_BUF_SIZE + 1 ? yy_buf_cap * 2 : keep + YY_BUF_SIZE + 1;\n";
+	ofs << '\t' << '\t' << "char *buf = (char *)realloc(yy_buf, cap);\n";
+	ofs << '\t' << '\t' << "if (!buf)\n";
+	ofs << '\t' << '\t' << '\t' << "YY_FATAL_ERROR(\"out of memory for the input buffer\");\n";
+	ofs << '\t' << '\t' << "yy_buf = buf;\n";
+	ofs << '\t' << '\t' << "yy_buf_cap = cap;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "p = yy_buf;\n";
+	ofs << '\t' << "*forward = p + fwd;\n";
+	ofs << '\t' << "if (*lastPos)\n";
+	ofs << '\t' << '\t' << "*lastPos = p + last;\n";
+	ofs << '\t' << "YY_INPUT(yy_buf + keep, n, yy_buf_cap - keep - 1);\n";
+	ofs << '\t' << "if (n <= 0) {\n";
+	ofs << '\t' << '\t' << "yy_eof = 1;\n";
+	ofs << '\t' << '\t' << "n = 0;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "yy_buf_end = yy_buf + keep + n;\n";
+	ofs << '\t' << "*yy_buf_end = '\\0';\n";
+	ofs << '\t' << "return n > 0;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "/* Whether there is input left at p, reading more when the buffer is used up */\n";
+	ofs << "int yy_more_input(" << scan_params(opts, "") << ") {\n";
+	ofs << '\t' << "char *forward, *lastPos = 0;\n";
+	ofs << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "if (p != yy_buf_end)\n";
+	ofs << '\t' << '\t' << "return 1;\n";
+	ofs << '\t' << "if (!yy_buf) {\n";
+	ofs << '\t' << '\t' << "yy_buf_cap = YY_BUF_SIZE + 1;\n";
+	ofs << '\t' << '\t' << "p = yy_buf_end = yy_buf = (char *)malloc(yy_buf_cap);\n";
+	ofs << '\t' << '\t' << "if (!yy_buf)\n";
+	ofs << '\t' << '\t' << '\t' << "YY_FATAL_ERROR(\"out of memory for the input buffer\");\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "forward = p;\n";
+	ofs << '\t' << "return " << scan_call(opts, "yy_refill", "&forward, &lastPos") << ";\n";
+	ofs << "}\n\n";
+}
+
+// In a scan that jammed: when the scan is at the sentinel of the buffer, refill it and resume
+// (with --input=stream)
+void gen_refill(ofstream &ofs, const LexOptions &opts, const string &indent, const string &resume)
+{
+	if (opts.input == LexOptions::STREAM_INPUT)
+	{
+		ofs << indent << "if (forward == yy_buf_end && " << scan_call(opts, "yy_refill", "&forward, &lastPos") << ")\n";
+		ofs << indent << '\t' << resume << ";\n";
+	}
+}
+
+// End the token at the end of the longest match, which may be before forward when the scan
+// went on past an accepting state (backing up), or after one byte when no rule matches
+void gen_backup(ofstream &ofs)
+{
+	ofs << '\t' << '\t' << "forward = lastPos ? lastPos : p + 1;\n";
+}
+
+// Declarations of the token text: with --yytext=pointer, yytext and yytextlen become a pointer
+// into the input and its length (yyleng), defined after the copied code, which declares the
+// 256 byte array of the copying scanner in y.tab.h. With YY_TEXT_NUL defined, the byte after the
+// token is replaced with a NUL until the next token; code that reads the input outside yylex
+// (such as input() in minic.l) calls yy_text_restore() first, a no-op in the other cases, unless it
+// goes through yy_more_input(), which calls it
+void gen_text_decls(ofstream &ofs, const LexOptions &opts)
+{
+	const string noop = string("#define yy_text_restore(") + (opts.reentrant ? "s" : "") + ") ((void)0)\n";
+	if (opts.text == LexOptions::COPY_TEXT)
+	{
+		ofs << noop << '\n';
+		return;
+	}
+	if (!opts.reentrant)
+	{
+		ofs << "char *yy_text_ptr = 0;\n";
+		ofs << "int yyleng = 0;\n";
+		ofs << "#define yytext yy_text_ptr\n";
+		ofs << "#define yytextlen yyleng\n";
+	}
+	ofs << "#ifdef YY_TEXT_NUL\n";
+	if (!opts.reentrant)
+	{
+		ofs << "static char *yy_hold_pos = 0;\n";
+		ofs << "static char yy_hold_char;\n";
+	}
+	ofs << "static void yy_text_restore(" << scan_params(opts, "") << ") {\n";
+	ofs << '\t' << "if (yy_hold_pos) {\n";
+	ofs << '\t' << '\t' << "*yy_hold_pos = yy_hold_char;\n";
+	ofs << '\t' << '\t' << "yy_hold_pos = 0;\n";
+	ofs << '\t' << "}\n";
+	ofs << "}\n";
+	ofs << "#else\n";
+	ofs << noop;
+	ofs << "#endif\n\n";
+}
+
+// Copy the token [p, forward) to yytext, or point yytext at it, and move p past it
+void gen_yytext(ofstream &ofs, LexOptions::Text text)
+{
+	if (text == LexOptions::POINTER_TEXT)
+	{
+		ofs << '\t' << '\t' << "yyleng = forward - p;\n";
+		ofs << '\t' << '\t' << "yy_text_ptr = p;\n";
+		ofs << "#ifdef YY_TEXT_NUL\n";
+		ofs << '\t' << '\t' << "yy_hold_pos = forward;\n";
+		ofs << '\t' << '\t' << "yy_hold_char = *forward;\n";
+		ofs << '\t' << '\t' << "*forward = '\\0';\n";
+		ofs << "#endif\n";
+		ofs << '\t' << '\t' << "p = forward;\n";
+		return;
+	}
+	ofs << '\t' << '\t' << "yytextlen = forward - p;\n";
+	ofs << '\t' << '\t' << "int i = 0;\n";
+	ofs << '\t' << '\t' << "for (; i < yytextlen; ++i) {\n";
+	ofs << '\t' << '\t' << '\t' << "yytext[i] = p[i];\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << "yytext[i] = '\\0';\n";
+	ofs << '\t' << '\t' << "p = forward;\n";
+}
+
+// The narrowest unsigned C type that holds values up to maxValue
+const char *elem_type(size_t maxValue)
+{
+	return maxValue <= 0xff ? "unsigned char" : maxValue <= 0xffff ? "unsigned short" : "unsigned int";
+}
+
+// Compress the transition table (row displacement with default states, as flex does):
+// A state may name an earlier state as its default (def), and keep only the classes where its row
+// differs from the row of the default; the kept entries of all states are packed into one
+// array, each state at its own offset (base) such that no two entries collide, and chk records
+// which state owns each slot. The next state of s on c is then
+//     while (chk[base[s] + c] != s) s = def[s];   next[base[s] + c]
+// and a state with no default keeps all its entries. -1 stands for none in def, chk and next
+void compress_tables(const DFA &dfa, vector<long long> &def, vector<long long> &base, vector<long long> &nxt, vector<long long> &chk)
+{
+	const size_t n = dfa.get_size();
+	const size_t k = dfa.get_num_classes();
+	const size_t WINDOW = 128; // Earlier states tried as the default, the rest is too slow for large DFAs
+	vector<vector<size_t>> kept(n); // Classes kept by each state
+	def.assign(n, -1);
+	for (size_t s = 0; s < n; ++s)
+	{
+		for (size_t c = 0; c < k; ++c)
+		{
+			if (dfa.get_tran(s, c) != (size_t)-1)
+			{
+				kept[s].push_back(c);
+			}
+		}
+		size_t best = kept[s].size();
+		for (size_t d = s > WINDOW ? s - WINDOW : 0; d < s; ++d)
+		{
+			size_t diff = 1; // The default costs about one entry
+			for (size_t c = 0; c < k && diff < best; ++c)
+			{
+				diff += dfa.get_tran(s, c) != dfa.get_tran(d, c);
+			}
+			if (diff < best)
+			{
+				best = diff;
+				def[s] = d;
+			}
+		}
+		if (def[s] != -1)
+		{
+			kept[s].clear();
+			for (size_t c = 0; c < k; ++c)
+			{
+				if (dfa.get_tran(s, c) != dfa.get_tran(def[s], c))
+				{
+					kept[s].push_back(c);
+				}
+			}
+		}
+	}
+
+	// First fit, the fullest rows first
+	vector<size_t> order(n);
+	for (size_t s = 0; s < n; ++s)
+	{
+		order[s] = s;
+	}
+	stable_sort(order.begin(), order.end(), [&kept](size_t a, size_t b)
+				{ return kept[a].size() > kept[b].size(); });
+	base.assign(n, 0);
+	vector<bool> used;
+	for (size_t s : order)
+	{
+		size_t b = 0;
+		for (;; ++b)
+		{
+			bool fits = true;
+			for (size_t c : kept[s])
+			{
+				if (b + c < used.size() && used[b + c])
 				{
-					res.push_back(*c);
+					fits = false;
+					break;
 				}
 			}
-			res.push_back(to_operator(')'));
+			if (fits)
+			{
+				break;
+			}
+		}
+		base[s] = b;
+		if (used.size() < b + k)
+		{ // Every base[s] + c must be in the arrays
+			used.resize(b + k, false);
+			nxt.resize(b + k, -1);
+			chk.resize(b + k, -1);
+		}
+		for (size_t c : kept[s])
+		{
+			used[b + c] = true;
+			chk[b + c] = s;
+			nxt[b + c] = dfa.get_tran(s, c) == (size_t)-1 ? -1 : (long long)dfa.get_tran(s, c);
+		}
+	}
+}
+
+// A byte as it would be written in a rule
+string byte_text(size_t b)
+{
+	switch (b)
+	{
+	case '\n':
+		return "\\n";
+	case '\t':
+		return "\\t";
+	case ' ':
+		return "' '";
+	}
+	if (b > ' ' && b < 127)
+	{
+		return string(1, (char)b);
+	}
+	char buf[8];
+	snprintf(buf, sizeof(buf), "\\x%02x", (unsigned)b);
+	return buf;
+}
+
+// The bytes on which a state goes back to itself, as ranges [first, last], when it is worth
+// accelerating: when they form at most 4 ranges, such as the body of a // comment (all but '\n'),
+// a run of spaces or the tail of an identifier. Empty for the other states
+vector<pair<size_t, size_t>> accel_ranges(const DFA &dfa, size_t i)
+{
+	vector<pair<size_t, size_t>> ranges;
+	for (size_t b = 1; b < 256; ++b) // The NUL jams every state
+	{
+		if (dfa.get_class(b) == 0 || dfa.get_tran(i, dfa.get_class(b)) != i)
+		{
+			continue;
+		}
+		if (!ranges.empty() && ranges.back().second == b - 1)
+		{
+			ranges.back().second = b;
+		}
+		else
+		{
+			ranges.push_back(make_pair(b, b));
+		}
+	}
+	if (ranges.size() > 4)
+	{
+		ranges.clear();
+	}
+	return ranges;
+}
+
+// Generate the skip loops of the acceleration states (as Hyperscan does): yy_skip_k(s) returns
+// the first byte from s on that is not in the ranges the state loops on, comparing 16 bytes at a
+// time with SSE2, or one at a time without it (or with YY_NO_SIMD). The aligned 16 byte loads
+// never cross a page, so they may read past the sentinel but not fault.
+// Returns the skip loop of each state, 0 for none
+vector<size_t> gen_accel(ofstream &ofs, const DFA &dfa)
+{
+	vector<size_t> accel(dfa.get_size());
+	map<vector<pair<size_t, size_t>>, size_t> loops; // Loop number of each set of ranges
+	for (size_t i = 0; i < dfa.get_size(); ++i)
+	{
+		const vector<pair<size_t, size_t>> ranges = accel_ranges(dfa, i);
+		if (ranges.empty())
+		{
+			continue;
+		}
+		if (loops.count(ranges))
+		{
+			accel[i] = loops.at(ranges);
+			continue;
+		}
+		if (loops.empty())
+		{
+			ofs << "#if defined(__SSE2__) && !defined(YY_NO_SIMD)\n";
+			ofs << "#include <emmintrin.h>\n";
+			ofs << "#include <stdint.h>\n";
+			ofs << "#endif\n\n";
+		}
+		accel[i] = loops.size() + 1;
+		loops.insert(make_pair(ranges, accel[i]));
+		ofs << "/* Skip";
+		for (const auto &r : ranges)
+		{
+			ofs << ' ' << byte_text(r.first);
+			if (r.second != r.first)
+			{
+				ofs << '-' << byte_text(r.second);
+			}
+		}
+		ofs << " */\n";
+		ofs << "static const char *yy_skip_" << accel[i] << "(const char *s) {\n";
+		ofs << "#if defined(__SSE2__) && !defined(YY_NO_SIMD)\n";
+		ofs << '\t' << "const __m128i *q = (const __m128i *)((uintptr_t)s & ~(uintptr_t)15);\n";
+		ofs << '\t' << "unsigned mask = 0xffffu << ((uintptr_t)s & 15);\n";
+		ofs << '\t' << "for (;;) {\n";
+		ofs << '\t' << '\t' << "__m128i x = _mm_load_si128(q), d, in;\n";
+		for (size_t k = 0; k < ranges.size(); ++k)
+		{ // x is in [first, last] when x - first, wrapped, is at most last - first
+			ofs << '\t' << '\t' << "d = _mm_sub_epi8(x, _mm_set1_epi8((char)" << ranges[k].first << "));\n";
+			ofs << '\t' << '\t' << (k == 0 ? "in = " : "in = _mm_or_si128(in, ")
+				<< "_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)" << ranges[k].second - ranges[k].first << ")), d)"
+				<< (k == 0 ? ";\n" : ");\n");
 		}
-		// End of bracket (Complement form)
-		else if (notBracketFlag && *it == ']' && is_not_escaped(it, exp))
+		ofs << '\t' << '\t' << "unsigned out = ~(unsigned)_mm_movemask_epi8(in) & mask;\n";
+		ofs << '\t' << '\t' << "if (out)\n";
+		ofs << '\t' << '\t' << '\t' << "return (const char *)q + __builtin_ctz(out);\n";
+		ofs << '\t' << '\t' << "mask = 0xffffu;\n";
+		ofs << '\t' << '\t' << "++q;\n";
+		ofs << '\t' << "}\n";
+		ofs << "#else\n";
+		ofs << '\t' << "for (;; ++s) {\n";
+		ofs << '\t' << '\t' << "unsigned char c = (unsigned char)*s;\n";
+		ofs << '\t' << '\t' << "if (";
+		for (size_t k = 0; k < ranges.size(); ++k)
 		{
-			notBracketFlag = false;
-			res.push_back(to_operator('('));
-			bool allChar[128];
-			// Calculation of the complement: Set the bool value of the
-			// corresponding position of all characters in the original set to 0
-			for (size_t i = 0; i < 128; ++i)
+			ofs << (k ? " && " : "") << "(unsigned char)(c - " << ranges[k].first << ") > " << ranges[k].second - ranges[k].first;
+		}
+		ofs << ")\n";
+		ofs << '\t' << '\t' << '\t' << "return s;\n";
+		ofs << '\t' << "}\n";
+		ofs << "#endif\n";
+		ofs << "}\n\n";
+	}
+	return accel;
+}
+
+// In a scan that went from stateNum back to it at forward: skip the rest of the run with the
+// acceleration loop of the state, if it has one (yy_accel), and go on from the byte after it.
+// The state may be the start state, which is not recorded as accepted until the scan returns to it
+void gen_accel_step(ofstream &ofs, size_t nloops, const string &indent, const string &cast)
+{
+	if (nloops == 0)
+	{
+		return;
+	}
+	ofs << indent << "if (next == stateNum && yy_accel[next]) {\n";
+	ofs << indent << '\t' << "switch (yy_accel[next]) {\n";
+	for (size_t k = 1; k <= nloops; ++k)
+	{
+		ofs << indent << '\t' << "case " << k << ":\n";
+		ofs << indent << '\t' << '\t' << "forward = " << cast << "yy_skip_" << k << "(forward + 1);\n";
+		ofs << indent << '\t' << '\t' << "break;\n";
+	}
+	ofs << indent << '\t' << "}\n";
+	ofs << indent << '\t' << "if (yy_accept[next]) {\n";
+	ofs << indent << '\t' << '\t' << "lastAccept = yy_accept[next] - 1;\n";
+	ofs << indent << '\t' << '\t' << "lastPos = forward;\n";
+	ofs << indent << '\t' << "}\n";
+	ofs << indent << '\t' << "continue;\n";
+	ofs << indent << "}\n";
+}
+
+// The next state of stateNum on the byte at forward, in next (YY_JAM for none)
+void gen_next(ofstream &ofs, LexOptions::Tables tables, const string &indent)
+{
+	if (tables == LexOptions::COMPRESSED_TABLES)
+	{ // Follow the default states until one keeps the class
+		ofs << indent << "unsigned c = yy_ec[(unsigned char)*forward];\n";
+		ofs << indent << "unsigned next = stateNum;\n";
+		ofs << indent << "while (next != YY_JAM && yy_chk[yy_base[next] + c] != next) {\n";
+		ofs << indent << '\t' << "next = yy_def[next];\n";
+		ofs << indent << "}\n";
+		ofs << indent << "if (next != YY_JAM) {\n";
+		ofs << indent << '\t' << "next = yy_nxt[yy_base[next] + c];\n";
+		ofs << indent << "}\n";
+	}
+	else
+	{
+		ofs << indent << "unsigned next = tran[stateNum][yy_ec[(unsigned char)*forward]];\n";
+	}
+}
+
+// Generate yylex_parallel (--parallel), which splits a buffer into one chunk per thread:
+// Every chunk but the first is scanned speculatively, as if a token started at its first byte.
+// Where a token starts depends only on where the previous one ends, so once the exact scan
+// (from the start of the buffer) reaches a position where a speculative token starts, the rest
+// of that chunk is exact. The chunks are joined in order: from the end of the exact tokens
+// of the previous chunks, the tokens are rescanned one at a time until they meet a speculative
+// token start, which usually takes a token or two. The tokens, in order, are those of yylex
+// as long as the actions do not read the input themselves; the sink gets each token with its
+// rule (-1 for a byte no rule matches), in place of the actions. The lengths and counts are
+// size_t, for buffers of several GB
+void gen_parallel(ofstream &ofs, const LexOptions &opts, size_t nloops)
+{
+	ofs << "#include <pthread.h>\n";
+	ofs << "#include <stdio.h>\n";
+	ofs << "#include <stdlib.h>\n";
+	ofs << "\n";
+	ofs << "/* The longest match at s, as yylex finds it: returns its rule, -1 if none, and its end in *end */\n";
+	ofs << "static int yy_match(const char *s, const char **end) {\n";
+	ofs << '\t' << "const char *forward = s, *lastPos = 0;\n";
+	ofs << '\t' << "int lastAccept = -1;\n";
+	ofs << '\t' << "unsigned stateNum = 0;\n";
+	ofs << '\t' << "for (;;) {\n";
+	gen_next(ofs, opts.tables, "\t\t");
+	ofs << '\t' << '\t' << "if (next == YY_JAM)\n";
+	ofs << '\t' << '\t' << '\t' << "break;\n";
+	gen_accel_step(ofs, nloops, "\t\t", "");
+	ofs << '\t' << '\t' << "stateNum = next;\n";
+	ofs << '\t' << '\t' << "if (yy_accept[stateNum]) {\n";
+	ofs << '\t' << '\t' << '\t' << "lastAccept = yy_accept[stateNum] - 1;\n";
+	ofs << '\t' << '\t' << '\t' << "lastPos = forward + 1;\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << "++forward;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "*end = lastPos ? lastPos : s + 1;\n";
+	ofs << '\t' << "return lastAccept;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "typedef void (*yy_sink_t)(int rule, const char *text, size_t len, void *arg);\n";
+	ofs << "struct yy_token {\n";
+	ofs << '\t' << "const char *text;\n";
+	ofs << '\t' << "size_t len;\n";
+	ofs << '\t' << "int rule;\n";
+	ofs << "};\n";
+	ofs << "struct yy_chunk {\n";
+	ofs << '\t' << "const char *begin, *end;	/* The tokens that start in [begin, end) */\n";
+	ofs << '\t' << "struct yy_token *tokens;\n";
+	ofs << '\t' << "size_t count, cap;\n";
+	ofs << '\t' << "int threaded;	/* Scanned on a thread of its own, to be joined */\n";
+	ofs << "};\n";
+	ofs << "#ifndef YY_FATAL_ERROR\n";
+	ofs << "#define YY_FATAL_ERROR(msg) (fprintf(stderr, \"%s\\n\", (msg)), exit(2))\n";
+	ofs << "#endif\n";
+	ofs << "\n";
+	ofs << "/* Scan a chunk as if a token started at its first byte */\n";
+	ofs << "static void *yy_scan_chunk(void *arg) {\n";
+	ofs << '\t' << "struct yy_chunk *c = (struct yy_chunk *)arg;\n";
+	ofs << '\t' << "const char *s = c->begin, *e;\n";
+	ofs << '\t' << "while (s < c->end) {\n";
+	ofs << '\t' << '\t' << "if (c->count == c->cap) {\n";
+	ofs << '\t' << '\t' << '\t' << "struct yy_token *t = (struct yy_token *)realloc(c->tokens, (c->cap * 2 + 64) * sizeof(struct yy_token));\n";
+	ofs << '\t' << '\t' << '\t' << "if (!t)\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "YY_FATAL_ERROR(\"out of memory for the tokens of a chunk\");\n";
+	ofs << '\t' << '\t' << '\t' << "c->tokens = t;\n";
+	ofs << '\t' << '\t' << '\t' << "c->cap = c->cap * 2 + 64;\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << "c->tokens[c->count].rule = yy_match(s, &e);\n";
+	ofs << '\t' << '\t' << "c->tokens[c->count].text = s;\n";
+	ofs << '\t' << '\t' << "c->tokens[c->count++].len = (size_t)(e - s);\n";
+	ofs << '\t' << '\t' << "s = e;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "/* Scan buf[0, len), with buf[len] == '\\0', on nthreads threads and pass the tokens in order\n";
+	ofs << "   to sink. Returns the number of tokens */\n";
+	ofs << "size_t yylex_parallel(const char *buf, size_t len, int nthreads, yy_sink_t sink, void *arg) {\n";
+	ofs << '\t' << "struct yy_chunk *chunks;\n";
+	ofs << '\t' << "pthread_t *threads;\n";
+	ofs << '\t' << "const char *pos = buf, *e;\n";
+	ofs << '\t' << "size_t total = 0, i;\n";
+	ofs << '\t' << "int k, rule;\n";
+	ofs << '\t' << "if (nthreads < 1)\n";
+	ofs << '\t' << '\t' << "nthreads = 1;\n";
+	ofs << '\t' << "if ((size_t)nthreads > len / 4096 + 1)	/* Not worth a thread for less than a page */\n";
+	ofs << '\t' << '\t' << "nthreads = (int)(len / 4096 + 1);\n";
+	ofs << '\t' << "chunks = (struct yy_chunk *)calloc(nthreads, sizeof(struct yy_chunk));\n";
+	ofs << '\t' << "threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));\n";
+	ofs << '\t' << "if (!chunks || !threads)\n";
+	ofs << '\t' << '\t' << "YY_FATAL_ERROR(\"out of memory for the chunks\");\n";
+	ofs << '\t' << "for (k = 0; k < nthreads; ++k) {\n";
+	ofs << '\t' << '\t' << "chunks[k].begin = buf + len / nthreads * k;\n";
+	ofs << '\t' << '\t' << "chunks[k].end = k + 1 < nthreads ? buf + len / nthreads * (k + 1) : buf + len;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "for (k = 1; k < nthreads; ++k)\n";
+	ofs << '\t' << '\t' << "chunks[k].threaded = pthread_create(&threads[k], 0, yy_scan_chunk, &chunks[k]) == 0;\n";
+	ofs << '\t' << "for (k = 0; k < nthreads; ++k) {	/* The first chunk, and those without a thread, here */\n";
+	ofs << '\t' << '\t' << "if (!chunks[k].threaded)\n";
+	ofs << '\t' << '\t' << '\t' << "yy_scan_chunk(&chunks[k]);\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "for (k = 1; k < nthreads; ++k) {\n";
+	ofs << '\t' << '\t' << "if (chunks[k].threaded)\n";
+	ofs << '\t' << '\t' << '\t' << "pthread_join(threads[k], 0);\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "for (k = 0; k < nthreads; ++k) {\n";
+	ofs << '\t' << '\t' << "/* Rescan from pos until it meets a token start of the chunk, then take the rest */\n";
+	ofs << '\t' << '\t' << "const struct yy_token *t = chunks[k].tokens;\n";
+	ofs << '\t' << '\t' << "i = 0;\n";
+	ofs << '\t' << '\t' << "while (pos < chunks[k].end) {\n";
+	ofs << '\t' << '\t' << '\t' << "while (i < chunks[k].count && t[i].text < pos)\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "++i;\n";
+	ofs << '\t' << '\t' << '\t' << "if (i < chunks[k].count && t[i].text == pos) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "for (; i < chunks[k].count; ++i, ++total)\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << '\t' << "sink(t[i].rule, t[i].text, t[i].len, arg);\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "pos = t[i - 1].text + t[i - 1].len;\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "break;\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "rule = yy_match(pos, &e);	/* Before e is read for the length */\n";
+	ofs << '\t' << '\t' << '\t' << "sink(rule, pos, (size_t)(e - pos), arg);\n";
+	ofs << '\t' << '\t' << '\t' << "++total;\n";
+	ofs << '\t' << '\t' << '\t' << "pos = e;\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "for (k = 0; k < nthreads; ++k)\n";
+	ofs << '\t' << '\t' << "free(chunks[k].tokens);\n";
+	ofs << '\t' << "free(chunks);\n";
+	ofs << '\t' << "free(threads);\n";
+	ofs << '\t' << "return total;\n";
+	ofs << "}\n\n";
+}
+
+void gen_code(ofstream &ofs, const DFA &dfa, const vector<string> &actions, const LexOptions &opts)
+{
+	const vector<size_t> accepts = dfa.get_accepts();
+	vector<long long> ec(256);
+	for (size_t b = 0; b < 256; ++b)
+	{
+		ec[b] = dfa.get_class(b);
+	}
+	gen_array(ofs, "static const unsigned char yy_ec[256]", ec); // Equivalence class of each byte
+
+	// State numbers take the narrowest type that also holds YY_JAM (no state)
+	const size_t jam = dfa.get_size() < 0xff ? 0xff : dfa.get_size() < 0xffff ? 0xffff : 0xffffffff;
+	ofs << "typedef " << elem_type(jam) << " yy_state_t;\n";
+	ofs << "#define YY_JAM " << jam << "u\n\n";
+	if (opts.tables == LexOptions::COMPRESSED_TABLES)
+	{
+		vector<long long> def, base, nxt, chk;
+		compress_tables(dfa, def, base, nxt, chk);
+		for (auto v : {&def, &nxt, &chk})
+		{
+			for (auto &x : *v)
 			{
-				allChar[i] = true;
+				x = x == -1 ? (long long)jam : x;
 			}
-			for (auto c = inBracket.begin(); c != inBracket.end(); ++c)
+		}
+		gen_array(ofs, "static const yy_state_t yy_def[]", def);
+		gen_array(ofs, string("static const ") + elem_type(nxt.size()) + " yy_base[]", base);
+		gen_array(ofs, "static const yy_state_t yy_nxt[]", nxt);
+		gen_array(ofs, "static const yy_state_t yy_chk[]", chk);
+	}
+	else
+	{
+		ofs << "static const yy_state_t tran[][" << dfa.get_num_classes() << "] = {\n";
+		for (size_t i = 0; i < dfa.get_size(); ++i)
+		{
+			ofs << '\t' << "{\t";
+			for (size_t c = 0; c < dfa.get_num_classes(); ++c)
 			{
-				if (*c == '\\')
+				if (dfa.get_tran(i, c) == (size_t)-1)
 				{
-					if (need_escape(*(++c)))
-					{
-						allChar[(size_t)(*c)] = false;
-					}
-					else
-					{
-						switch (*c)
-						{
-						case 'a':
-							allChar[(size_t)'\a'] = false;
-							break;
-						case 'b':
-							allChar[(size_t)'\b'] = false;
-							break;
-						case 'f':
-							allChar[(size_t)'\f'] = false;
-							break;
-						case 'n':
-							allChar[(size_t)'\n'] = false;
-							break;
-						case 'r':
-							allChar[(size_t)'\r'] = false;
-							break;
-						case 't':
-							allChar[(size_t)'\t'] = false;
-							break;
-						case 'v':
-							allChar[(size_t)'\v'] = false;
-							break;
-						}
-					}
+					ofs << "YY_JAM";
 				}
 				else
 				{
-					allChar[(size_t)(*c)] = false;
+					ofs << dfa.get_tran(i, c);
 				}
-			}
-			bool first = true;
-			for (size_t i = 0; i < 128; ++i)
-			{
-				if (allChar[i])
+				if (c != dfa.get_num_classes() - 1)
 				{
-					if (first)
-					{
-						first = false;
-					}
-					else
-					{
-						res.push_back(to_operator('|'));
-					}
-					char ch = (char)i;
-					res.push_back(ch);
-					// if (need_escape(ch)) {			// If you need to escape, add an escape symbol
-					//	res.push_back(ch);
-					// }
-					// else {
-					//
-					//	res.push_back(ch);
-					// }
+					ofs << ',';
 				}
+				ofs << '\t';
+			}
+			ofs << '}';
+			if (i != dfa.get_size() - 1)
+			{
+				ofs << ',';
 			}
-			res.push_back(to_operator(')'));
+			ofs << '\n';
 		}
-		// Inside the brackets, fill into the inBracket.
-		else if (bracketFlag || notBracketFlag)
+		ofs << "};\n\n";
+	}
+	// Rule accepted in each state plus one, 0 if none: one load per byte instead of
+	// comparing the state with every accepting state
+	vector<long long> accept(accepts.size());
+	for (size_t i = 0; i < accepts.size(); ++i)
+	{
+		accept[i] = accepts[i] == (size_t)-1 ? 0 : (long long)accepts[i] + 1;
+	}
+	gen_array(ofs, string("static const ") + elem_type(actions.size()) + " yy_accept[]", accept);
+	const vector<size_t> accel = gen_accel(ofs, dfa);
+	const size_t nloops = *max_element(accel.begin(), accel.end());
+	if (nloops)
+	{ // Skip loop of each state, 0 for none
+		gen_array(ofs, string("static const ") + elem_type(nloops) + " yy_accel[]", vector<long long>(accel.begin(), accel.end()));
+	}
+	ofs << "int yylex(" << (opts.reentrant ? "yyscan_t yyscanner" : "") << ") {\n";
+	ofs << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "while (" << scan_call(opts, "yy_more_input", "") << ") {\n";
+	ofs << '\t' << '\t' << "if (*p == '\\n')\t++line;\n";
+	ofs << '\t' << '\t' << "char *forward = p;\n";
+	ofs << '\t' << '\t' << "unsigned lastAccept = -1;\n";
+	ofs << '\t' << '\t' << "char *lastPos = 0;\n";
+	ofs << '\t' << '\t' << "unsigned stateNum = 0;\n";
+	ofs << '\t' << '\t' << "for (;;) {\n"; // The NUL at the end jams, as no rule matches it
+	gen_next(ofs, opts.tables, "\t\t\t");
+	ofs << '\t' << '\t' << '\t' << "if (next == YY_JAM) {\n";
+	gen_refill(ofs, opts, "\t\t\t\t", "continue");
+	ofs << '\t' << '\t' << '\t' << '\t' << "break;\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	gen_accel_step(ofs, nloops, "\t\t\t", "(char *)");
+	ofs << '\t' << '\t' << '\t' << "stateNum = next;\n";
+	ofs << '\t' << '\t' << '\t' << "if (yy_accept[stateNum]) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "lastAccept = yy_accept[stateNum] - 1;\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "lastPos = forward + 1;\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "++forward;\n";
+	ofs << '\t' << '\t' << "}\n";
+	gen_backup(ofs);
+	gen_yytext(ofs, opts.text);
+	ofs << '\t' << '\t' << "switch (lastAccept) {\n";
+	for (size_t i = 0; i < actions.size(); ++i)
+	{
+		ofs << '\t' << '\t' << "case " << i << ":\n";
+		ofs << '\t' << '\t' << '\t' << actions[i] << '\n';
+		ofs << '\t' << '\t' << '\t' << "break;\n";
+	}
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "printf(\"unexpected eof\");\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n\n";
+	if (opts.parallel)
+	{
+		gen_parallel(ofs, opts, nloops);
+	}
+}
+
+// Generate a direct-coded lexer (as re2c does): every DFA state is a labelled block that
+// switches on the next byte and jumps to the block of the next state, so the scan does
+// no table lookups and the C compiler sees the branches of each state.
+// Its tokens are the same as those of the table-driven lexer of gen_code
+void gen_goto_code(ofstream &ofs, const DFA &dfa, const vector<string> &actions, const LexOptions &opts)
+{
+	const vector<size_t> accepts = dfa.get_accepts();
+	const vector<size_t> accel = gen_accel(ofs, dfa);
+	ofs << "int yylex(" << (opts.reentrant ? "yyscan_t yyscanner" : "") << ") {\n";
+	ofs << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "while (" << scan_call(opts, "yy_more_input", "") << ") {\n";
+	ofs << '\t' << '\t' << "if (*p == '\\n')	++line;\n";
+	ofs << '\t' << '\t' << "char *forward = p;\n";
+	ofs << '\t' << '\t' << "int lastAccept = -1;\n";
+	ofs << '\t' << '\t' << "char *lastPos = 0;\n";
+	if (accepts[0] != (size_t)-1)
+	{ // As in gen_code, the start state accepts only when the scan comes back to it
+		ofs << '\t' << '\t' << "goto yy_start;\n";
+	}
+	// The states that something jumps to: the targets of the transitions, and with --input=stream
+	// the states that resume after a refill. The others (the start state, mostly) get no label
+	vector<bool> jumped(dfa.get_size(), false);
+	for (size_t i = 0; i < dfa.get_size(); ++i)
+	{
+		for (size_t b = 1; b < 256; ++b)
 		{
-			if (*it != '-' || *(it + 1) == ']')
+			size_t t = dfa.get_class(b) == 0 ? (size_t)-1 : dfa.get_tran(i, dfa.get_class(b));
+			if (t != (size_t)-1)
 			{
-				inBracket.push_back(*it);
+				jumped[t] = true;
+				jumped[i] = jumped[i] || opts.input == LexOptions::STREAM_INPUT;
 			}
-			else
-			{ // 0-9 => from 0 to 9.
-				// *(it - 1) has been in inBracket.
-				for (char ch = *(it - 1) + 1; ch < *(it + 1); ++ch)
-				{
-					inBracket.push_back(ch);
-				}
+		}
+	}
+	for (size_t i = 0; i < dfa.get_size(); ++i)
+	{
+		if (jumped[i])
+		{
+			ofs << "\tyy_state_" << i << ":\n";
+		}
+		if (accepts[i] != (size_t)-1)
+		{
+			ofs << '\t' << '\t' << "lastAccept = " << accepts[i] << ";\n";
+			ofs << '\t' << '\t' << "lastPos = forward;\n";
+		}
+		if (i == 0 && accepts[i] != (size_t)-1)
+		{
+			ofs << "\tyy_start:\n";
+		}
+		// The bytes that lead to each next state, in order of their first byte
+		vector<pair<size_t, vector<size_t>>> targets;
+		map<size_t, size_t> where;
+		for (size_t b = 1; b < 256; ++b)
+		{
+			size_t t = dfa.get_tran(i, dfa.get_class(b));
+			if (dfa.get_class(b) == 0 || t == (size_t)-1)
+			{
+				continue;
+			}
+			if (!where.count(t))
+			{
+				where.insert(pair<size_t, size_t>(t, targets.size()));
+				targets.push_back(make_pair(t, vector<size_t>()));
 			}
+			targets[where.at(t)].second.push_back(b);
 		}
-		else
+		if (targets.empty())
 		{
-			if (*it == '\\')
+			ofs << '\t' << '\t' << "goto yy_done;\n";
+			continue;
+		}
+		ofs << '\t' << '\t' << "switch ((unsigned char)*forward) {\n";
+		for (const auto &t : targets)
+		{
+			for (size_t k = 0; k < t.second.size(); ++k)
 			{
-				if (need_escape(*(++it)))
-				{
-					res.push_back(*it);
+				size_t b = t.second[k];
+				ofs << (k % 8 == 0 ? "\t\t" : " ") << "case ";
+				if (b > ' ' && b < 127 && b != '\'' && b != '\\')
+				{ // Printable characters as themselves
+					ofs << '\'' << (char)b << '\'';
 				}
 				else
 				{
-					switch (*it)
-					{
-					case 'a':
-						res.push_back('\a');
-						break;
-					case 'b':
-						res.push_back('\b');
-						break;
-					case 'f':
-						res.push_back('\f');
-						break;
-					case 'n':
-						res.push_back('\n');
-						break;
-					case 'r':
-						res.push_back('\r');
-						break;
-					case 't':
-						res.push_back('\t');
-						break;
-					case 'v':
-						res.push_back('\v');
-						break;
-					}
+					ofs << b;
 				}
+				ofs << ":" << (k % 8 == 7 || k + 1 == t.second.size() ? "\n" : "");
+			}
+			if (t.first == i && accel[i])
+			{ // Skip the rest of the run
+				ofs << '\t' << '\t' << '\t' << "forward = (char *)yy_skip_" << accel[i] << "(forward + 1);\n";
 			}
 			else
 			{
-				if (need_escape(*it))
-				{
-					res.push_back(to_operator(*it));
-				}
-				else
-				{
-					res.push_back(*it);
-				}
+				ofs << '\t' << '\t' << '\t' << "++forward;\n";
 			}
+			ofs << '\t' << '\t' << '\t' << "goto yy_state_" << t.first << ";\n";
 		}
+		ofs << '\t' << '\t' << "default:\n";
+		gen_refill(ofs, opts, "\t\t\t", "goto yy_state_" + to_string(i));
+		ofs << '\t' << '\t' << '\t' << "goto yy_done;\n";
+		ofs << '\t' << '\t' << "}\n";
 	}
-	return res;
+	ofs << "\tyy_done:\n";
+	gen_backup(ofs);
+	gen_yytext(ofs, opts.text);
+	ofs << '\t' << '\t' << "switch (lastAccept) {\n";
+	for (size_t i = 0; i < actions.size(); ++i)
+	{
+		ofs << '\t' << '\t' << "case " << i << ":\n";
+		ofs << '\t' << '\t' << '\t' << actions[i] << '\n';
+		ofs << '\t' << '\t' << '\t' << "break;\n";
+	}
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "printf(\"unexpected eof\");\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n\n";
 }
 
-// Parse regular definitions according to map
-vector<char> explain_defs(const vector<char> &rgx, const map<string, vector<char>> &mp)
+// Generate a lexer with a lazy DFA, for rules whose DFA is too large to build:
+// The NFA is written out with its transitions on byte classes and its ε-closures,
+// and the lexer builds each DFA state the first time the scan reaches it.
+// The DFA states live in a cache of YY_LAZY_MAX_STATES states (a macro of the lexer),
+// when it is full it is flushed and the scan goes on from the current state, as RE2 does
+void gen_lazy_code(ofstream &ofs, const NFA &nfa, const vector<size_t> &nacn, const vector<string> &actions, const LexOptions &opts)
 {
-	vector<char> res;
-	bool braceFlag = false;
-	string defName; // The used regular defines symbols
-	for (vector<char>::const_iterator it = rgx.begin(); it != rgx.end(); ++it)
+	array<size_t, 256> classes;
+	size_t nclasses = nfa.char_classes(classes);
+	vector<size_t> represent(nclasses, -1); // A byte of each class
+	vector<long long> ec(256);
+	for (size_t b = 0; b < 256; ++b)
 	{
-		if (*it == to_operator('{') && !braceFlag)
+		ec[b] = classes[b];
+		if (represent[classes[b]] == (size_t)-1)
 		{
-			braceFlag = true;
-			defName.clear();
+			represent[classes[b]] = b;
 		}
-		else if (*it == to_operator('}') && braceFlag)
+	}
+
+	// Transitions of state s are yy_nfa_tran_[cls|to][yy_nfa_tran_start[s], yy_nfa_tran_start[s + 1]),
+	// one per class of each label, sorted by class
+
+	const vector<uint32_t> &tranStart = nfa.get_tran_start();
+	const vector<NFA::Tran> &tran = nfa.get_tran();
+	vector<long long> start(1, 0), cls, to;
+	for (size_t s = 0; s < nfa.get_size(); ++s)
+	{
+		vector<pair<size_t, uint32_t>> row;
+		for (size_t i = tranStart[s]; i < tranStart[s + 1]; ++i)
 		{
-			braceFlag = false;
-			if (mp.count(defName) == 0)
-			{
-			} // Maybe an error?
-			else
+			for (size_t c = 1; c < nclasses; ++c)
 			{
-				res.push_back(to_operator('('));
-				for (auto c : mp.at(defName))
+				if (nfa.label_has(tran[i].label, represent[c]))
 				{
-					res.push_back(c);
+					row.push_back(make_pair(c, tran[i].to));
 				}
-				res.push_back(to_operator(')'));
 			}
 		}
-		else if (braceFlag)
-		{
-			defName.push_back(*it);
-		}
-		else
+		sort(row.begin(), row.end());
+		for (auto &t : row)
 		{
-			res.push_back(*it);
+			cls.push_back(t.first);
+			to.push_back(t.second);
 		}
+		start.push_back(cls.size());
+	}
+	vector<long long> closStart(nfa.get_clos_start().begin(), nfa.get_clos_start().end());
+	vector<long long> closure(nfa.get_closure().begin(), nfa.get_closure().end());
+	vector<long long> accept(nacn.begin(), nacn.end());
+	for (auto &a : accept)
+	{
+		a = a == (long long)(size_t)-1 ? -1 : a;
+	}
+
+	ofs << "#include <stdlib.h>\n";
+	ofs << "#include <string.h>\n\n";
+	ofs << "#define YY_NFA_STATES " << nfa.get_size() << "\n";
+	ofs << "#define YY_NCLASSES " << nclasses << "\n\n";
+	gen_array(ofs, "static const unsigned char yy_ec[256]", ec);
+	gen_array(ofs, "static const int yy_nfa_tran_start[]", start);
+	gen_array(ofs, "static const int yy_nfa_tran_cls[]", cls);
+	gen_array(ofs, "static const int yy_nfa_tran_to[]", to);
+	gen_array(ofs, "static const int yy_nfa_clos_start[]", closStart);
+	gen_array(ofs, "static const int yy_nfa_clos[]", closure);
+	gen_array(ofs, "static const int yy_nfa_accept[]", accept); // Rule accepted in each state, -1 if none
+
+	// The DFA state cache
+
+	ofs << "#ifndef YY_LAZY_MAX_STATES\n";
+	ofs << "#define YY_LAZY_MAX_STATES 1024	/* DFA states kept in the cache */\n";
+	ofs << "#endif\n";
+	ofs << "#ifndef YY_LAZY_POOL_SIZE\n";
+	ofs << "#define YY_LAZY_POOL_SIZE (YY_LAZY_MAX_STATES * 16 + 2 * YY_NFA_STATES)	/* NFA state numbers kept for them */\n";
+	ofs << "#endif\n";
+	ofs << "#define YY_LAZY_BUCKETS (2 * YY_LAZY_MAX_STATES)\n";
+	ofs << "\n";
+	ofs << "struct yy_lazy_state {\n";
+	ofs << '\t' << "int next[YY_NCLASSES];	/* Successor on each class, -1 if not built yet, -2 if none */\n";
+	ofs << '\t' << "int accept;				/* Rule accepted in this state, -1 if none */\n";
+	ofs << '\t' << "int set, len;			/* The NFA states are yy_lazy_pool[set, set + len) */\n";
+	ofs << '\t' << "unsigned hash;\n";
+	ofs << "};\n";
+	ofs << "static struct yy_lazy_state yy_lazy_states[YY_LAZY_MAX_STATES];\n";
+	ofs << "static int yy_lazy_count = 0;\n";
+	ofs << "static int yy_lazy_pool[YY_LAZY_POOL_SIZE];\n";
+	ofs << "static int yy_lazy_pool_used = 0;\n";
+	ofs << "static int yy_lazy_buckets[YY_LAZY_BUCKETS];\n";
+	ofs << "static int yy_lazy_start = -1;				/* The start state, -1 if not in the cache */\n";
+	ofs << "static int yy_lazy_ready = 0;\n";
+	ofs << "static int yy_lazy_mark[YY_NFA_STATES];		/* Scratch set of NFA states */\n";
+	ofs << "static int yy_lazy_stamp = 0;\n";
+	ofs << "static int yy_lazy_work[YY_NFA_STATES];\n";
+	ofs << "int yy_lazy_resets = 0;						/* Number of cache flushes */\n";
+	ofs << "\n";
+	ofs << "/* Flush the cache */\n";
+	ofs << "static void yy_lazy_reset(void) {\n";
+	ofs << '\t' << "int i;\n";
+	ofs << '\t' << "for (i = 0; i < YY_LAZY_BUCKETS; ++i)\n";
+	ofs << '\t' << '\t' << "yy_lazy_buckets[i] = -1;\n";
+	ofs << '\t' << "yy_lazy_count = 0;\n";
+	ofs << '\t' << "yy_lazy_pool_used = 0;\n";
+	ofs << '\t' << "yy_lazy_start = -1;\n";
+	ofs << '\t' << "++yy_lazy_resets;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "static int yy_lazy_cmp(const void *a, const void *b) {\n";
+	ofs << '\t' << "return *(const int *)a - *(const int *)b;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "/* The DFA state of a sorted set of NFA states, added to the cache if new; -1 if the cache is full */\n";
+	ofs << "static int yy_lazy_intern(const int *set, int len) {\n";
+	ofs << '\t' << "unsigned h = 2166136261u;\n";
+	ofs << '\t' << "int i, b, s;\n";
+	ofs << '\t' << "for (i = 0; i < len; ++i)\n";
+	ofs << '\t' << '\t' << "h = (h ^ (unsigned)set[i]) * 16777619u;\n";
+	ofs << '\t' << "for (b = h % YY_LAZY_BUCKETS; (s = yy_lazy_buckets[b]) != -1; b = (b + 1) % YY_LAZY_BUCKETS) {\n";
+	ofs << '\t' << '\t' << "if (yy_lazy_states[s].hash == h && yy_lazy_states[s].len == len\n";
+	ofs << '\t' << '\t' << '\t' << "&& memcmp(yy_lazy_pool + yy_lazy_states[s].set, set, len * sizeof(int)) == 0)\n";
+	ofs << '\t' << '\t' << '\t' << "return s;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "if (yy_lazy_count == YY_LAZY_MAX_STATES || yy_lazy_pool_used + len > YY_LAZY_POOL_SIZE)\n";
+	ofs << '\t' << '\t' << "return -1;\n";
+	ofs << '\t' << "s = yy_lazy_count++;\n";
+	ofs << '\t' << "yy_lazy_buckets[b] = s;\n";
+	ofs << '\t' << "yy_lazy_states[s].hash = h;\n";
+	ofs << '\t' << "yy_lazy_states[s].set = yy_lazy_pool_used;\n";
+	ofs << '\t' << "yy_lazy_states[s].len = len;\n";
+	ofs << '\t' << "memcpy(yy_lazy_pool + yy_lazy_pool_used, set, len * sizeof(int));\n";
+	ofs << '\t' << "yy_lazy_pool_used += len;\n";
+	ofs << '\t' << "yy_lazy_states[s].accept = -1;\n";
+	ofs << '\t' << "for (i = 0; i < len; ++i)\n";
+	ofs << '\t' << '\t' << "if (yy_nfa_accept[set[i]] != -1 && (yy_lazy_states[s].accept == -1 || yy_nfa_accept[set[i]] < yy_lazy_states[s].accept))\n";
+	ofs << '\t' << '\t' << '\t' << "yy_lazy_states[s].accept = yy_nfa_accept[set[i]];\n";
+	ofs << '\t' << "for (i = 0; i < YY_NCLASSES; ++i)\n";
+	ofs << '\t' << '\t' << "yy_lazy_states[s].next[i] = -1;\n";
+	ofs << '\t' << "yy_lazy_states[s].next[0] = -2;		/* Class 0 has no transitions */\n";
+	ofs << '\t' << "return s;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "/* The start state: the ε-closure of NFA state 0 */\n";
+	ofs << "static int yy_lazy_begin(void) {\n";
+	ofs << '\t' << "if (!yy_lazy_ready) {\n";
+	ofs << '\t' << '\t' << "yy_lazy_reset();\n";
+	ofs << '\t' << '\t' << "yy_lazy_resets = 0;\n";
+	ofs << '\t' << '\t' << "yy_lazy_ready = 1;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "if (yy_lazy_start == -1) {\n";
+	ofs << '\t' << '\t' << "yy_lazy_start = yy_lazy_intern(yy_nfa_clos + yy_nfa_clos_start[0], yy_nfa_clos_start[1] - yy_nfa_clos_start[0]);\n";
+	ofs << '\t' << '\t' << "if (yy_lazy_start == -1) {\n";
+	ofs << '\t' << '\t' << '\t' << "yy_lazy_reset();\n";
+	ofs << '\t' << '\t' << '\t' << "yy_lazy_start = yy_lazy_intern(yy_nfa_clos + yy_nfa_clos_start[0], yy_nfa_clos_start[1] - yy_nfa_clos_start[0]);\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "return yy_lazy_start;\n";
+	ofs << "}\n";
+	ofs << "\n";
+	ofs << "/* Build the successor of DFA state s on class c from the ε-closures of the NFA targets.\n";
+	ofs << "   When the cache is full it is flushed (s is gone then), and scanning goes on from the successor */\n";
+	ofs << "static int yy_lazy_build(int s, int c) {\n";
+	ofs << '\t' << "int len = 0, i, j, k, t, n;\n";
+	ofs << '\t' << "if (++yy_lazy_stamp == 0x7fffffff) {\n";
+	ofs << '\t' << '\t' << "memset(yy_lazy_mark, 0, sizeof(yy_lazy_mark));\n";
+	ofs << '\t' << '\t' << "yy_lazy_stamp = 1;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "for (i = 0; i < yy_lazy_states[s].len; ++i) {\n";
+	ofs << '\t' << '\t' << "n = yy_lazy_pool[yy_lazy_states[s].set + i];\n";
+	ofs << '\t' << '\t' << "for (j = yy_nfa_tran_start[n]; j < yy_nfa_tran_start[n + 1] && yy_nfa_tran_cls[j] <= c; ++j) {\n";
+	ofs << '\t' << '\t' << '\t' << "t = yy_nfa_tran_to[j];\n";
+	ofs << '\t' << '\t' << '\t' << "if (yy_nfa_tran_cls[j] != c || yy_lazy_mark[t] == yy_lazy_stamp)\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "continue;\n";
+	ofs << '\t' << '\t' << '\t' << "for (k = yy_nfa_clos_start[t]; k < yy_nfa_clos_start[t + 1]; ++k) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "if (yy_lazy_mark[yy_nfa_clos[k]] != yy_lazy_stamp) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << '\t' << "yy_lazy_mark[yy_nfa_clos[k]] = yy_lazy_stamp;\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << '\t' << "yy_lazy_work[len++] = yy_nfa_clos[k];\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "if (len == 0) {\n";
+	ofs << '\t' << '\t' << "yy_lazy_states[s].next[c] = -2;\n";
+	ofs << '\t' << '\t' << "return -2;\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "qsort(yy_lazy_work, len, sizeof(int), yy_lazy_cmp);\n";
+	ofs << '\t' << "t = yy_lazy_intern(yy_lazy_work, len);\n";
+	ofs << '\t' << "if (t == -1) {\n";
+	ofs << '\t' << '\t' << "yy_lazy_reset();\n";
+	ofs << '\t' << '\t' << "return yy_lazy_intern(yy_lazy_work, len);\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "yy_lazy_states[s].next[c] = t;\n";
+	ofs << '\t' << "return t;\n";
+	ofs << "}\n";
+
+	// The scanner, the same as gen_code but over the cached states
+
+	ofs << "int yylex(" << (opts.reentrant ? "yyscan_t yyscanner" : "") << ") {\n";
+	ofs << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "while (" << scan_call(opts, "yy_more_input", "") << ") {\n";
+	ofs << '\t' << '\t' << "if (*p == '\\n')	++line;\n";
+	ofs << '\t' << '\t' << "char *forward = p;\n";
+	ofs << '\t' << '\t' << "int lastAccept = -1;\n";
+	ofs << '\t' << '\t' << "char *lastPos = 0;\n";
+	ofs << '\t' << '\t' << "int stateNum = yy_lazy_begin();\n";
+	ofs << '\t' << '\t' << "for (;;) {\n";
+	ofs << '\t' << '\t' << '\t' << "int c = yy_ec[(unsigned char)*forward];\n";
+	ofs << '\t' << '\t' << '\t' << "int next = yy_lazy_states[stateNum].next[c];\n";
+	ofs << '\t' << '\t' << '\t' << "if (next == -1) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "next = yy_lazy_build(stateNum, c);\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "if (next == -2) {\n";
+	gen_refill(ofs, opts, "\t\t\t\t", "continue");
+	ofs << '\t' << '\t' << '\t' << '\t' << "break;\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "stateNum = next;\n";
+	ofs << '\t' << '\t' << '\t' << "if (yy_lazy_states[stateNum].accept != -1) {\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "lastAccept = yy_lazy_states[stateNum].accept;\n";
+	ofs << '\t' << '\t' << '\t' << '\t' << "lastPos = forward + 1;\n";
+	ofs << '\t' << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << '\t' << "++forward;\n";
+	ofs << '\t' << '\t' << "}\n";
+	gen_backup(ofs);
+	gen_yytext(ofs, opts.text);
+	ofs << '\t' << '\t' << "switch (lastAccept) {\n";
+	for (size_t i = 0; i < actions.size(); ++i)
+	{
+		ofs << '\t' << '\t' << "case " << i << ":\n";
+		ofs << '\t' << '\t' << '\t' << actions[i] << '\n';
+		ofs << '\t' << '\t' << '\t' << "break;\n";
+	}
+	ofs << '\t' << '\t' << "}\n";
+	ofs << '\t' << '\t' << scan_call(opts, "yy_text_restore", "") << ";\n";
+	ofs << '\t' << "}\n";
+	ofs << '\t' << "printf(\"unexpected eof\");\n";
+	ofs << '\t' << "return 0;\n";
+	ofs << "}\n\n";
+}
+
+// Measurements of one run of the generator, reported with --stats
+struct LexStats
+{
+	vector<pair<string, double>> phases; // Wall time of each phase in milliseconds, in order
+	chrono::steady_clock::time_point last;
+	size_t nfaStates, nfaEdges;			 // Merged NFA
+	size_t dfaStates, dfaEdges;			 // DFA of the subset construction
+	size_t liveStates, liveEdges;		 // After delete_dead_states
+	size_t minStates, minEdges;			 // After minimize
+	BuildCounters counters;
+	bool cached; // The DFA was loaded from the cache
+
+	LexStats() : last(chrono::steady_clock::now()), nfaStates(0), nfaEdges(0), dfaStates(0), dfaEdges(0),
+				 liveStates(0), liveEdges(0), minStates(0), minEdges(0), cached(false) {}
+	// End the current phase
+	void lap(const string &phase)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		phases.push_back(make_pair(phase, chrono::duration<double, milli>(now - last).count()));
+		last = now;
 	}
-	return res;
-}
+	void report(ostream &os, bool json) const;
+};
 
-//
+// Peak resident set size of the process in KB
+size_t peak_rss_kb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	return K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? pmc.PeakWorkingSetSize / 1024 : 0;
+#else
+	struct rusage ru;
+	return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0; // KB on Linux
+#endif
+}
 
-// Processing point
-vector<char> deal_dot(const vector<char> &seq)
+void LexStats::report(ostream &os, bool json) const
 {
-	vector<char> res;
-	for (vector<char>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	double total = 0;
+	for (const auto &ph : phases)
 	{
-		// (Dot.) In the default mode, this matches any character except a newline.
-		if (*it == to_operator('.'))
-		{
-			res.push_back(to_operator('('));
-			bool first = true;
-			for (unsigned i = 0; i < 128; ++i)
-			{
-				if (i != '\n')
-				{
-					if (first)
-					{
-						first = false;
-						res.push_back((char)i);
-					}
-					else
-					{
-						res.push_back(to_operator('|'));
-						res.push_back((char)i);
-					}
-				}
-			}
-			res.push_back(to_operator(')'));
-		}
-		else
+		total += ph.second;
+	}
+	double hitRate = counters.internLookups ? (double)counters.internHits / counters.internLookups : 0;
+	os << fixed << setprecision(3);
+	if (json)
+	{
+		os << "{\"phases_ms\": {";
+		for (size_t i = 0; i < phases.size(); ++i)
 		{
-			res.push_back(*it);
+			os << (i ? ", " : "") << '"' << phases[i].first << "\": " << phases[i].second;
 		}
+		os << "}, \"total_ms\": " << total << ", \"peak_rss_kb\": " << peak_rss_kb()
+		   << ", \"nfa\": {\"states\": " << nfaStates << ", \"edges\": " << nfaEdges << "}"
+		   << ", \"dfa\": {\"states\": " << dfaStates << ", \"edges\": " << dfaEdges << "}"
+		   << ", \"dfa_live\": {\"states\": " << liveStates << ", \"edges\": " << liveEdges << "}"
+		   << ", \"dfa_min\": {\"states\": " << minStates << ", \"edges\": " << minEdges << "}"
+		   << ", \"closure_calls\": " << counters.closureCalls
+		   << ", \"intern\": {\"lookups\": " << counters.internLookups << ", \"hits\": " << counters.internHits
+		   << ", \"hit_rate\": " << hitRate << "}"
+		   << ", \"cached\": " << (cached ? "true" : "false") << "}\n";
+		return;
 	}
-	return res;
+	for (const auto &ph : phases)
+	{
+		os << left << setw(16) << ph.first << right << setw(12) << ph.second << " ms\n";
+	}
+	os << left << setw(16) << "total" << right << setw(12) << total << " ms\n";
+	os << "peak RSS        " << peak_rss_kb() << " KB\n";
+	os << "NFA             " << nfaStates << " states, " << nfaEdges << " edges\n";
+	os << "DFA             " << dfaStates << " states, " << dfaEdges << " edges" << (cached ? " (cached)" : "") << "\n";
+	os << "live DFA        " << liveStates << " states, " << liveEdges << " edges\n";
+	os << "minimal DFA     " << minStates << " states, " << minEdges << " edges\n";
+	os << "closures        " << counters.closureCalls << "\n";
+	os << "intern          " << counters.internLookups << " lookups, " << counters.internHits << " hits ("
+	   << hitRate * 100 << "%)\n";
 }
 
-// /* => /&*
-// struct => s&t&r&u&c&t
-// 0(x|X)((a-fA-F0-9))+(((u|U)|(u|U)?(l|L|ll|LL)|(l|L|ll|LL)(u|U)))? =>
-// 0&(x|X)&((a-fA-F0-9))+&(((u|U)|(u|U)?&(l|L|l&l|L&L)|(l|L|l&l|L&L)&(u|U)))?
-
-// Add a connector (to operator('&'), in the form of an operator)
-vector<char> seq_to_infix(const vector<char> &seq)
+// Thompson engine: convert every rule to an NFA and merge them,
+// output the merged NFA and the rule accepted in each of its states (-1 for none)
+NFA thompson_nfa(const RegexDag &dag, const vector<uint32_t> &ruleRoots, unsigned threads, vector<size_t> &Naccept, LexStats &stats)
 {
-	vector<char> res;
-	bool pre = false;
-	for (vector<char>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	// Convert all regular expressions to NFA, one rule per task on the thread pool
+
+	const vector<bool> shared = dag.shared_nodes(ruleRoots);
+	const vector<NFA::Template> templates = nfa_templates(dag, shared);
+	vector<NFA> nfas(ruleRoots.size());
+	parallel_for(ruleRoots.size(), threads, [&](size_t i)
+				 { nfas[i] = dag_to_nfa(dag, ruleRoots[i], shared, templates); });
+	stats.lap("nfa");
+
+	// Merge all Nfas, output the total NFA and accept the status number table.
+
+	NFA mergedNFA;
+	vector<size_t> NAcceptedStates = mergedNFA.merge_nfa(nfas);
+	Naccept.resize(mergedNFA.get_size());
+	for (auto &acn : Naccept)
 	{
-		if (pre)
-		{
-			if (!is_optr(*it) || to_char(*it) == '(')
-			{
-				res.push_back(to_operator('&'));
-				res.push_back(*it);
-			}
-			else
-			{
-				res.push_back(*it);
-			}
-		}
-		else
-		{
-			res.push_back(*it);
-		}
-		if (!is_optr(*it) || to_char(*it) == ')' || to_char(*it) == '*' || to_char(*it) == '+' || to_char(*it) == '?')
-		{
-			pre = true;
-		}
-		else
-		{
-			pre = false;
-		}
+		acn = -1;
 	}
-	return res;
+	for (size_t i = 0; i < NAcceptedStates.size(); ++i)
+	{
+		Naccept[NAcceptedStates[i]] = i;
+	}
+	stats.lap("merge");
+	stats.nfaStates = mergedNFA.get_size();
+	stats.nfaEdges = mergedNFA.get_num_edges();
+	return mergedNFA;
 }
 
-// 0&(x|X)&((a-fA-F0-9))+&(((u|U)|(u|U)?&(l|L|l&l|L&L)|(l|L|l&l|L&L)&(u|U)))? =>
-// 0xX|&ab|c|d|e|f|A|B|C|D|E|F|0|1|2|3|4|5|6|7|8|9|+&uU|uU|?lL|ll&|LL&|&|lL|ll&|LL&|uU|&|?&
+// Thompson engine, then convert NFA to DFA
+DFA thompson_dfa(const RegexDag &dag, const vector<uint32_t> &ruleRoots, unsigned threads, LexStats &stats)
+{
+	vector<size_t> Naccept;
+	NFA mergedNFA = thompson_nfa(dag, ruleRoots, threads, Naccept, stats);
+	DFA dfa(mergedNFA, Naccept, threads);
+	stats.lap("subset");
+	return dfa;
+}
 
-// Converts an infix regular expression to a suffix regular expression
-vector<char> infix_to_suffix(const vector<char> &seq)
+// Followpos engine: build one syntax tree of all rules and construct the DFA directly
+DFA followpos_dfa(const RegexDag &dag, const vector<uint32_t> &ruleRoots, LexStats &stats)
 {
-	vector<char> res;
-	stack<char> optrStk;
-	map<char, int> priority{
-		{'*', 7},
-		{'+', 7},
-		{'?', 7},
-		{'&', 5},
-		{'|', 3}};
-	for (vector<char>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	RegexTree tree;
+	const vector<bool> shared = dag.shared_nodes(ruleRoots);
+	for (uint32_t r : ruleRoots)
 	{
-		if (!is_optr(*it))
-		{
-			res.push_back(*it);
-		}
-		else
-		{
-			if (*it == to_operator('('))
-			{
-				optrStk.push(*it);
-			}
-			else if (*it == to_operator(')'))
-			{
-				while (!optrStk.empty() && to_char(optrStk.top()) != '(')
-				{
-					res.push_back(optrStk.top());
-					optrStk.pop();
-				}
-				if (!optrStk.empty())
-				{
-					optrStk.pop();
-				}
-			}
-			else
-			{
-				if (optrStk.empty() || to_char(optrStk.top()) == '(')
-				{
-					optrStk.push(*it);
-				}
-				else
-				{
-					if (priority[to_char(*it)] > priority[to_char(optrStk.top())])
-					{
-						optrStk.push(*it);
-					}
-					else
-					{
-						while (!optrStk.empty() && priority[to_char(*it)] <= priority[to_char(optrStk.top())])
-						{
-							res.push_back(optrStk.top());
-							optrStk.pop();
-						}
-						optrStk.push(*it);
-					}
-				}
-			}
-		}
+		tree.add_rule(dag, r, shared);
 	}
-	while (!optrStk.empty())
+	tree.finish();
+	stats.lap("followpos");
+	DFA dfa(tree);
+	stats.lap("subset");
+	return dfa;
+}
+
+// Key of the compiled DFA cache: FNV-1a over the hashes of the rules in the DAG,
+// which only depend on the rules after the definitions are explained
+// (character sets by their members, since set numbers may change)
+// Change CACHE_VERSION whenever the generator builds different DFAs from the same rules
+const uint64_t CACHE_VERSION = 2;
+uint64_t rules_key(const RegexDag &dag, const vector<uint32_t> &ruleRoots)
+{
+	uint64_t h = 14695981039346656037ULL;
+	auto mix = [&h](uint64_t v)
 	{
-		res.push_back(optrStk.top());
-		optrStk.pop();
+		h ^= v;
+		h *= 1099511628211ULL;
+	};
+	mix(CACHE_VERSION);
+	for (uint32_t r : ruleRoots)
+	{
+		mix(dag.get_node(r).hash);
 	}
-	return res;
+	return h;
 }
 
-// Convert the suffix expression to NFA
-NFA suffix_to_nfa(const vector<char> &seq)
+// The rules after the definitions are explained, as text that is the same exactly when the rules
+// are: the DAG nodes they reach, numbered in the order they are finished (children first), each as
+// its operator and its operand (a set by its members) or the numbers of its children, then the
+// number of each root. The cache file holds it, so rules whose keys collide do not share a DFA
+string rules_text(const RegexDag &dag, const vector<uint32_t> &ruleRoots)
 {
-	stack<NFA> s;
-	for (vector<char>::const_iterator it = seq.begin(); it != seq.end(); ++it)
+	string text;
+	map<uint32_t, uint32_t> number;	  // DAG node -> its number in the text
+	vector<pair<uint32_t, bool>> stk; // Node, whether its children are done
+	for (uint32_t r : ruleRoots)
 	{
-		if (!is_optr(*it))
-		{
-			s.push(NFA(to_char(*it)));
-		}
-		else
+		stk.push_back(make_pair(r, false));
+		while (!stk.empty())
 		{
-			if (to_char(*it) == '|')
+			pair<uint32_t, bool> top = stk.back();
+			stk.pop_back();
+			const RegexDag::Node &nd = dag.get_node(top.first);
+			if (number.count(top.first))
 			{
-				NFA rhs = s.top();
-				s.pop();
-				NFA lhs = s.top();
-				s.pop();
-				lhs.opt_union(rhs);
-				s.push(lhs);
-			}
-			else if (to_char(*it) == '&')
-			{
-				NFA rhs = s.top();
-				s.pop();
-				NFA lhs = s.top();
-				s.pop();
-				lhs.opt_concat(rhs);
-				s.push(lhs);
+				continue;
 			}
-			else if (to_char(*it) == '*')
+			if (nd.op != 0 && !top.second)
 			{
-				NFA lhs = s.top();
-				s.pop();
-				lhs.opt_star();
-				s.push(lhs);
+				stk.push_back(make_pair(top.first, true));
+				stk.push_back(make_pair(nd.right, false));
+				stk.push_back(make_pair(nd.left, false));
+				continue;
 			}
-			else if (to_char(*it) == '+')
+			if (nd.op == 0 && is_charset(nd.sym))
 			{
-				NFA lhs = s.top();
-				s.pop();
-				lhs.opt_plus();
-				s.push(lhs);
+				const CharSet &cs = dag.get_set(nd.sym - CHARSET_BASE);
+				text += "set " + to_string((cs >> 64).to_ullong()) + " " + to_string((cs & CharSet(0xffffffffffffffffULL)).to_ullong());
 			}
-			else if (to_char(*it) == '?')
+			else if (nd.op == 0)
 			{
-				NFA lhs = s.top();
-				s.pop();
-				lhs.opt_quest();
-				s.push(lhs);
+				text += "sym " + to_string(nd.sym);
 			}
 			else
 			{
+				text += string(1, (char)nd.op) + " " + to_string(number.at(nd.left)) + " " + to_string(number.at(nd.right));
 			}
+			text += '\n';
+			number.insert(make_pair(top.first, (uint32_t)number.size()));
 		}
+		text += "rule " + to_string(number.at(r)) + "\n";
 	}
-	return s.top();
+	return text;
+}
+
+// Profile of the rules, for finding the ones that make the DFA large:
+// For each rule its NFA states, the states of its own minimal DFA, the states of the minimal DFA
+// of all rules that are lost without it (what it adds), and the states of the combined DFA
+// that accept it. The rules that add the most states are flagged
+void rule_report(ostream &os, const RegexDag &dag, const vector<uint32_t> &ruleRoots, const vector<string> &rules,
+				 const DFA &combined, unsigned threads)
+{
+	auto min_states = [&dag](const vector<uint32_t> &roots)
+	{
+		LexStats ignored;
+		DFA dfa = thompson_dfa(dag, roots, 1, ignored);
+		dfa.delete_dead_states();
+		dfa.minimize();
+		return dfa.get_size();
+	};
+	size_t n = ruleRoots.size();
+	const vector<bool> shared = dag.shared_nodes(ruleRoots);
+	const vector<NFA::Template> templates = nfa_templates(dag, shared);
+	vector<size_t> nfaStates(n), alone(n), without(n), accepting(n, 0);
+	parallel_for(n, threads, [&](size_t i)
+				 {
+		nfaStates[i] = dag_to_nfa(dag, ruleRoots[i], shared, templates).get_size();
+		alone[i] = min_states(vector<uint32_t>(1, ruleRoots[i]));
+		vector<uint32_t> others(ruleRoots);
+		others.erase(others.begin() + i);
+		without[i] = others.empty() ? 0 : min_states(others); });
+	for (size_t acc : combined.get_accepts())
+	{
+		if (acc != (size_t)-1)
+		{
+			++accepting[acc];
+		}
+	}
+
+	// The worst offenders: the (up to) three rules that add the most states
+	vector<size_t> order(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		order[i] = i;
+	}
+	auto added = [&](size_t i)
+	{
+		return combined.get_size() > without[i] ? combined.get_size() - without[i] : 0;
+	};
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+				{ return added(a) > added(b); });
+	vector<bool> worst(n, false);
+	for (size_t k = 0; k < n && k < 3 && added(order[k]) > 0; ++k)
+	{
+		worst[order[k]] = true;
+	}
+
+	os << "rule  NFA states  own DFA  adds  accepting  pattern\n";
+	for (size_t i = 0; i < n; ++i)
+	{
+		string pattern = rules[i].size() > 40 ? rules[i].substr(0, 37) + "..." : rules[i];
+		os << setw(4) << i << setw(12) << nfaStates[i] << setw(9) << alone[i] << setw(6) << added(i)
+		   << setw(11) << accepting[i] << "  " << pattern << (worst[i] ? "  <== worst" : "") << '\n';
+	}
+	os << "combined minimal DFA: " << combined.get_size() << " states\n";
 }
 
-void gen_code(ofstream &ofs, const DFA &dfa, const vector<string> &actions)
+// Backing up report (as flex -b does): The scanner has to back up in a state that does not accept
+// but jams on some input, since it then rescans the input after the last accepting state.
+// For each such state: the shortest input that reaches it, the bytes it jams on, 1 to 255 (every
+// such state jams at the end of the input, the NUL), and the rules it may still match, which are the ones to rewrite
+// (e.g. by adding rules for the prefixes) to get a scanner that never backs up
+void backup_report(ostream &os, const DFA &dfa, const vector<string> &rules)
 {
+	const size_t n = dfa.get_size();
 	const vector<size_t> accepts = dfa.get_accepts();
-	ofs << "unsigned tran[][128] = {\n";
-	for (size_t i = 0; i < dfa.get_size(); ++i)
+
+	// Shortest input to each state, breadth first from the start state
+	vector<string> path(n);
+	vector<bool> seen(n, false);
+	vector<size_t> queue(1, 0);
+	seen[0] = true;
+	for (size_t q = 0; q < queue.size(); ++q)
 	{
-		ofs << '\t' << "{\t";
-		for (size_t ch = 0; ch < 128; ++ch)
+		size_t s = queue[q];
+		for (size_t b = 1; b < 256; ++b)
 		{
-			ofs << dfa.get_tran(i, ch);
-			if (ch != 127)
+			size_t t = dfa.get_class(b) == 0 ? (size_t)-1 : dfa.get_tran(s, dfa.get_class(b));
+			if (t != (size_t)-1 && !seen[t])
 			{
-				ofs << ',';
+				seen[t] = true;
+				path[t] = path[s] + byte_text(b);
+				queue.push_back(t);
 			}
-			ofs << '\t';
 		}
-		ofs << '}';
-		if (i != dfa.get_size() - 1)
+	}
+
+	size_t count = 0;
+	for (size_t s = 1; s < n; ++s)
+	{ // The start state never backs up, there is nothing to back up to
+		if (accepts[s] != (size_t)-1)
 		{
-			ofs << ',';
+			continue;
 		}
-		ofs << '\n';
-	}
-	ofs << "};\n\n";
-	ofs << "int yylex() {\n";
-	ofs << '\t' << "while (*p) {\n";
-	ofs << '\t' << '\t' << "if (*p == '\\n')\t++line;\n";
-	ofs << '\t' << '\t' << "char *forward = p;\n";
-	ofs << '\t' << '\t' << "unsigned lastAccept = -1;\n";
-	ofs << '\t' << '\t' << "unsigned stateNum = 0;\n";
-	ofs << '\t' << '\t' << "for (int i = 0; *forward; ++i) {\n";
-	ofs << '\t' << '\t' << '\t' << "stateNum = tran[stateNum][(unsigned)*forward];\n";
-	ofs << '\t' << '\t' << '\t' << "if (stateNum == -1) {\n";
-	ofs << '\t' << '\t' << '\t' << '\t' << "break;\n";
-	ofs << '\t' << '\t' << '\t' << "}\n";
-	ofs << '\t' << '\t' << '\t' << "else if (stateNum == ";
-	bool first = true;
-	for (size_t i = 0; i < accepts.size(); ++i)
-	{
-		if (accepts[i] != -1)
+		++count;
+		os << "state " << s << " after \"" << path[s] << "\" jams on:";
+		for (size_t b = 1; b < 256; ++b)
 		{
-			if (first)
+			if (dfa.get_class(b) != 0 && dfa.get_tran(s, dfa.get_class(b)) != (size_t)-1)
 			{
-				first = false;
+				continue;
 			}
-			else
+			size_t e = b; // A run of jamming bytes
+			while (e + 1 < 256 && (dfa.get_class(e + 1) == 0 || dfa.get_tran(s, dfa.get_class(e + 1)) == (size_t)-1))
 			{
-				ofs << " || stateNum == ";
+				++e;
 			}
-			ofs << i;
+			os << ' ' << byte_text(b) << (e > b ? "-" + byte_text(e) : ""); // \xNN for the bytes not printable
+			b = e;
 		}
-	}
-	ofs << ") {\n";
-	ofs << '\t' << '\t' << '\t' << '\t' << "lastAccept = stateNum;\n";
-	ofs << '\t' << '\t' << '\t' << "}\n";
-	ofs << '\t' << '\t' << '\t' << "++forward;\n";
-	ofs << '\t' << '\t' << "}\n";
-	ofs << '\t' << '\t' << "yytextlen = forward - p;\n";
-	ofs << '\t' << '\t' << "int i = 0;\n";
-	ofs << '\t' << '\t' << "for (; i < yytextlen; ++i) {\n";
-	ofs << '\t' << '\t' << '\t' << "yytext[i] = p[i];\n";
-	ofs << '\t' << '\t' << "}\n";
-	ofs << '\t' << '\t' << "yytext[i] = '\\0';\n";
-	ofs << '\t' << '\t' << "p = forward;\n";
-	ofs << '\t' << '\t' << "switch (lastAccept) {\n";
-	for (size_t i = 0; i < accepts.size(); ++i)
-	{
-		if (accepts[i] != -1)
+		os << " end-of-input\n";
+
+		// The rules accepted in the states reachable from s
+		set<size_t> reach;
+		vector<size_t> stack(1, s);
+		vector<bool> visited(n, false);
+		visited[s] = true;
+		while (!stack.empty())
+		{
+			size_t t = stack.back();
+			stack.pop_back();
+			if (accepts[t] != (size_t)-1)
+			{
+				reach.insert(accepts[t]);
+			}
+			for (size_t c = 0; c < dfa.get_num_classes(); ++c)
+			{
+				size_t u = dfa.get_tran(t, c);
+				if (u != (size_t)-1 && !visited[u])
+				{
+					visited[u] = true;
+					stack.push_back(u);
+				}
+			}
+		}
+		for (size_t r : reach)
 		{
-			ofs << '\t' << '\t' << "case " << i << ":\n";
-			ofs << '\t' << '\t' << '\t' << actions[accepts[i]] << '\n';
-			ofs << '\t' << '\t' << '\t' << "break;\n";
+			os << "    rule " << r << "  " << rules[r] << '\n';
 		}
 	}
-	ofs << '\t' << '\t' << "}\n";
-	ofs << '\t' << "}\n";
-	ofs << '\t' << "printf(\"unexpected eof\");\n";
-	ofs << '\t' << "return 0;\n";
-	ofs << "}\n\n";
+	if (count == 0)
+	{
+		os << "No backing up.\n";
+	}
+	else
+	{
+		os << count << " of " << n << " states back up.\n";
+	}
+}
+
+// The options that the generated lexers can not combine, or that would be ignored
+string options_error(const LexOptions &opts)
+{
+	if (opts.lazyDfa && (opts.backend == LexOptions::GOTO_BACKEND || opts.tables == LexOptions::COMPRESSED_TABLES ||
+						 !opts.cacheDir.empty() || opts.engine == LexOptions::FOLLOWPOS || opts.ruleReport || opts.backupReport))
+	{ // These build, store or report on the DFA, which the generator does not build with a lazy DFA
+		return "--lazy-dfa does not support --backend=goto, --tables=compressed, --cache-dir, --engine=followpos, --rule-report or --backup-report";
+	}
+	if (opts.reentrant && opts.lazyDfa)
+	{ // The lazy DFA keeps its state cache in globals
+		return "--reentrant does not support --lazy-dfa";
+	}
+	if (opts.parallel && (opts.lazyDfa || opts.backend == LexOptions::GOTO_BACKEND))
+	{
+		return "--parallel needs the transition tables, not --lazy-dfa or --backend=goto";
+	}
+	return "";
 }
 
 // Parse the lex file, generate a lexer, and return the error line number
-int ParseLexFile(ifstream &ifs, ofstream &ofs)
+int ParseLexFile(ifstream &ifs, ofstream &ofs, const LexOptions &opts)
 {
+	if (!options_error(opts).empty())
+	{
+		return -2;
+	}
+	LexStats stats;
 
 	vector<string> names;		// Regular definition - name (corresponding to defined index)
 	vector<string> definitions; // Regular definition - definition (corresponding to name index)
@@ -1098,6 +3771,10 @@ int ParseLexFile(ifstream &ifs, ofstream &ofs)
 
 		while (getline(ifs, line))
 		{ // First find two %% and divide the file into three parts
+			if (!line.empty() && line.back() == '\r')
+			{ // Lex files written on Windows end lines with CRLF
+				line.pop_back();
+			}
 			if (line.empty())
 				continue;
 			++lineCount;
@@ -1188,78 +3865,152 @@ int ParseLexFile(ifstream &ifs, ofstream &ofs)
 		}
 	}
 
+	stats.lap("read");
+
 	// Parse definitions and rules into sequences
 
-	vector<vector<char>> defsSeq;
+	vector<CharSet> charSets; // Character sets of all bracket expressions and dots
+	vector<vector<int>> defsSeq;
 	for (auto d : definitions)
 	{
-		defsSeq.push_back(deal_brkt_qt(d));
+		defsSeq.push_back(deal_brkt_qt(d, charSets));
 	}
-	// [0-9] => (0|1|2|3|4|5|6|7|8|9)
+	// [0-9] => <set 0123456789>
 
-	vector<vector<char>> rulesSeq;
+	vector<vector<int>> rulesSeq;
 	for (auto r : rules)
 	{
-		rulesSeq.push_back(deal_brkt_qt(r));
+		rulesSeq.push_back(deal_brkt_qt(r, charSets));
 	}
 	// {D}*"."{D}+{E}?{FS}? =>
 	// {D}*.{D}+{E}?{FS}?
 
-	// Interpret nested definitions in regular definitions
-	// (that is, the latter definition uses the contents of the previous definition),
-	// and establish a mapping of names to definitions
+	// Parse the definitions into one DAG, in order, so that a definition can use the
+	// previous ones (by node), then the rules: {D}+ => (node of D)+
 
-	map<string, vector<char>> mapNameToDef;
-	mapNameToDef.insert(pair<string, vector<char>>(names[0], defsSeq[0])); // First add.
-	for (size_t i = 1; i < defsSeq.size(); ++i)
-	{ // Subsequent definitions recursively use established mappings
-		mapNameToDef.insert(pair<string, vector<char>>(names[i], explain_defs(defsSeq[i], mapNameToDef)));
+	RegexDag dag;
+	map<string, size_t> mapNameToDef;
+	vector<uint32_t> defRoots;
+	for (size_t i = 0; i < defsSeq.size(); ++i)
+	{
+		vector<int> seq = deal_dot(ref_defs(defsSeq[i], mapNameToDef), charSets);
+		defRoots.push_back(dag.add_suffix(infix_to_suffix(seq_to_infix(seq)), charSets, defRoots));
+		mapNameToDef.insert(pair<string, size_t>(names[i], i));
+	}
+	vector<uint32_t> ruleRoots;
+	for (auto &r : rulesSeq)
+	{
+		vector<int> seq = deal_dot(ref_defs(r, mapNameToDef), charSets);
+		ruleRoots.push_back(dag.add_suffix(infix_to_suffix(seq_to_infix(seq)), charSets, defRoots));
 	}
 
-	// Explain regular definitions in regular expressions
+	stats.lap("parse");
+
+	unsigned threads = opts.threads != 0 ? opts.threads : thread::hardware_concurrency();
+	threads = threads != 0 ? threads : 1;
 
-	for (auto &pd : rulesSeq)
+	// A lazy DFA lexer only needs the NFA
+
+	if (opts.lazyDfa)
 	{
-		vector<char> npd = explain_defs(pd, mapNameToDef);
-		pd = npd;
+		vector<size_t> Naccept;
+		NFA nfa = thompson_nfa(dag, ruleRoots, threads, Naccept, stats);
+		ofs << toCopy << '\n';
+		gen_text_decls(ofs, opts);
+		gen_input_decls(ofs, opts);
+		gen_lazy_code(ofs, nfa, Naccept, actions, opts);
+		ofs << subRout << '\n';
+		stats.lap("gen_code");
+		if (opts.stats != LexOptions::NO_STATS)
+		{
+			stats.report(cerr, opts.stats == LexOptions::STATS_JSON);
+		}
+		return 0;
 	}
 
-	// {L}({L}|{D})* =>
-	// ((a-zA-Z_))(((a-zA-Z_))|((0-9)))*
-
-	// Convert all regular expressions to NFA
+	// Look the rules up in the cache of compiled DFAs
 
-	vector<NFA> nfas;
-	for (auto r : rulesSeq)
+	DFA dfa;
+	string cacheFile, rulesText;
+	bool cached = false;
+	if (!opts.cacheDir.empty())
 	{
-		nfas.push_back(suffix_to_nfa(infix_to_suffix(seq_to_infix(deal_dot(r)))));
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.dfa", (unsigned long long)rules_key(dag, ruleRoots));
+		cacheFile = opts.cacheDir + "/" + name;
+		ifstream cfs(cacheFile.c_str(), ios::binary);
+		rulesText = rules_text(dag, ruleRoots);
+		cached = cfs && dfa.load(cfs, rules_key(dag, ruleRoots), rulesText, ruleRoots.size());
+		stats.lap("cache load");
 	}
 
-	// Merge all Nfas, output the total NFA and accept the status number table.
+	// Otherwise build the DFA with the chosen engine, minimizing DFA
 
-	NFA mergedNFA;
-	vector<size_t> NAcceptedStates = mergedNFA.merge_nfa(nfas);
-	vector<size_t> Naccept(mergedNFA.get_size());
-	for (auto &acn : Naccept)
+	if (!cached)
 	{
-		acn = -1;
+		dfa = opts.engine == LexOptions::FOLLOWPOS ? followpos_dfa(dag, ruleRoots, stats) : thompson_dfa(dag, ruleRoots, threads, stats);
+		stats.dfaStates = dfa.get_size();
+		stats.dfaEdges = dfa.get_num_edges();
+		stats.counters = dfa.get_counters();
+		dfa.delete_dead_states();
+		stats.lap("dead states");
+		stats.liveStates = dfa.get_size();
+		stats.liveEdges = dfa.get_num_edges();
+		dfa.minimize();
+		stats.lap("minimize");
+
+		if (!cacheFile.empty())
+		{ // Write a temporary file first, so that no one reads a half written file
+			string tmpFile = cacheFile + ".tmp";
+			ofstream cfs(tmpFile.c_str(), ios::binary);
+			if (cfs && dfa.save(cfs, rules_key(dag, ruleRoots), rulesText))
+			{
+				cfs.close();
+				remove(cacheFile.c_str());
+				rename(tmpFile.c_str(), cacheFile.c_str());
+			}
+			else
+			{
+				cfs.close();
+				remove(tmpFile.c_str());
+			}
+			stats.lap("cache save");
+		}
 	}
-	for (size_t i = 0; i < NAcceptedStates.size(); ++i)
+	stats.cached = cached;
+	stats.minStates = dfa.get_size();
+	stats.minEdges = dfa.get_num_edges();
+	if (opts.ruleReport)
 	{
-		Naccept[NAcceptedStates[i]] = i;
+		rule_report(cerr, dag, ruleRoots, rules, dfa, threads);
+		stats.lap("rule report");
+	}
+	if (opts.backupReport)
+	{
+		backup_report(cerr, dfa, rules);
 	}
-
-	// Convert NFA to DFA, minimizing DFA
-
-	DFA dfa(mergedNFA, Naccept);
-	// dfa.minimize();
-	// dfa.delete_dead_states();
 
 	// Generate lexical analyzer source files according to DFA
 
 	ofs << toCopy << '\n';
-	gen_code(ofs, dfa, actions);
+	gen_scanner_begin(ofs, opts);
+	gen_text_decls(ofs, opts);
+	gen_input_decls(ofs, opts);
+	if (opts.backend == LexOptions::GOTO_BACKEND)
+	{
+		gen_goto_code(ofs, dfa, actions, opts);
+	}
+	else
+	{
+		gen_code(ofs, dfa, actions, opts);
+	}
+	gen_scanner_end(ofs, opts);
 	ofs << subRout << '\n';
+	stats.lap("gen_code");
+	if (opts.stats != LexOptions::NO_STATS)
+	{
+		stats.report(cerr, opts.stats == LexOptions::STATS_JSON);
+	}
 
 	return 0;
 }
\ No newline at end of file
@@ -1,78 +1,296 @@
 #include <fstream>
+#include <iostream>
 #include <vector>
 #include <deque>
 #include <string>
 #include <map>
 #include <array>
+#include <bitset>
+#include <cstdint>
+#include <tuple>
 using std::ifstream;
 using std::ofstream;
+using std::istream;
+using std::ostream;
 using std::vector;
 using std::deque;
 using std::array;
+using std::bitset;
 using std::map;
 using std::string;
 
-int ParseLexFile(ifstream& ifs, ofstream& ofs);
+// Options of the generator
+struct LexOptions {
+	enum Engine {
+		THOMPSON,		// Thompson construction, then subset construction
+		FOLLOWPOS		// Direct construction from the syntax tree, no ε transitions
+	};
+	Engine engine;
+	unsigned threads;	// Threads of the Thompson engine, 0 for all hardware threads
+	string cacheDir;	// Directory of the compiled DFA cache, empty for no cache
+	bool lazyDfa;		// Emit the NFA and a lexer that builds DFA states on demand, instead of the DFA
+	enum Stats {
+		NO_STATS,
+		STATS_TEXT,		// Report phase times, memory and automaton sizes on stderr
+		STATS_JSON		// The same as one JSON object
+	};
+	Stats stats;
+	bool ruleReport;	// Report on stderr how much each rule adds to the DFA
+	bool backupReport;	// Report on stderr the DFA states that make the scanner back up
+	enum Tables {
+		FULL_TABLES,		// One row of next states per state
+		COMPRESSED_TABLES	// Rows stored as differences from a default state, packed by row displacement
+	};
+	Tables tables;
+	enum Backend {
+		TABLE_BACKEND,		// yylex looks the next state up in the transition table
+		GOTO_BACKEND		// Every state is a block of code that jumps to the next state
+	};
+	Backend backend;
+	enum Text {
+		COPY_TEXT,		// yylex copies each token into the yytext array
+		POINTER_TEXT	// yytext points into the input, yyleng is its length
+	};
+	Text text;
+	enum Input {
+		STRING_INPUT,	// The input is one NUL-terminated string at p
+		STREAM_INPUT,	// yylex reads yyin into a buffer, refilled as it is scanned
+		MMAP_INPUT		// yy_map_file maps a file, which is scanned in place
+	};
+	Input input;
+	bool reentrant;		// The scanner state in a yyscan_t context instead of globals, yylex(yyscan_t)
+	bool parallel;		// Also emit yylex_parallel, which scans one buffer on several threads
+	LexOptions() : engine(THOMPSON), threads(0), lazyDfa(false), stats(NO_STATS), ruleReport(false),
+		backupReport(false), tables(FULL_TABLES), backend(TABLE_BACKEND), text(COPY_TEXT),
+		input(STRING_INPUT), reentrant(false), parallel(false) {}
+};
+
+// Why the options can not go together, empty when they can
+string options_error(const LexOptions& opts);
+// Returns 0, the line of an error in the lex file, -1 for a regular expression error,
+// or -2 when the options can not go together
+int ParseLexFile(ifstream& ifs, ofstream& ofs, const LexOptions& opts = LexOptions());
+
+typedef bitset<128> CharSet;	// A set of ASCII characters, e.g. [a-z] or .
+
+// Sparse set of states in [0, n):
+// Insertion, lookup and clearing are all constant time, so the same
+// buffers can be reused by every closure computation without reallocation
+class SparseSet {
+public:
+	explicit SparseSet(size_t n = 0) : dense(n), sparse(n), count(0) {}
+	void resize(size_t n) {
+		dense.resize(n);
+		sparse.resize(n);
+		count = 0;
+	}
+	inline bool contains(uint32_t s)const { return sparse[s] < count && dense[sparse[s]] == s; }
+	inline bool insert(uint32_t s) {
+		if (contains(s)) {
+			return false;
+		}
+		sparse[s] = count;
+		dense[count++] = s;
+		return true;
+	}
+	inline void clear() { count = 0; }
+	inline size_t size()const { return count; }
+	inline const uint32_t* begin()const { return dense.data(); }
+	inline const uint32_t* end()const { return dense.data() + count; }
+private:
+	vector<uint32_t> dense;		// Members in insertion order
+	vector<uint32_t> sparse;	// Position of each member in dense
+	uint32_t count;
+};
 
 // Uncertain finite automata:
-// The status set is all lines of Ntran
-// Input the alphabet as ASCII characters (129 columns with ε)
-// Convert function to member Ntran
-// The start state is the first line of Ntran
-// The accept state is the last line of Ntran
+// The states are numbered from 0 to get_size() - 1 (32-bit state numbers)
+// Input the alphabet as ASCII characters (label 128 is ε),
+// a transition may also be labelled by a whole character set (label 129 + i for sets[i])
+// The start state is state 0
+// The accept state is the last state
+// During Thompson construction the transitions are kept in one flat edge list that all
+// fragments of a rule share, merge_nfa then lays them out per state in contiguous arrays (compressed sparse rows),
+// with the character transitions and the ε transitions in separate arrays
 class NFA{
 public:
-	typedef array<vector<size_t>, 129> NST;	// Each row in the NFA state table: Transitions to other states.
-											// Each row contains 129 vectors
-											// Represents a successor collection on 128 ASCII and epsilon
-											// There is no duplication when adding, and it is more efficient to add 
-											// and change things using vector instead of set
-	NFA() {
-		Ntran.push_back(NST());
-	}
-	NFA(char ch);
-	inline size_t get_size()const { return Ntran.size(); }
-	void opt_union(const NFA&);
-	void opt_concat(const NFA&);
-	void opt_star();
-	void opt_plus();
-	void opt_quest();
+	struct Edge {			// Construction form: transition from -> to on label
+		uint32_t from;
+		uint32_t to;
+		uint32_t label;		// ASCII character, 128 for ε, or 129 + i for sets[i]
+	};
+	struct Tran {			// Row form: character transition of a state
+		uint32_t to;
+		uint32_t label;
+	};
+	// Thompson construction: a fragment is a start state and a list of dangling transitions
+	// (not pointing anywhere yet, linked through their to fields), the operators add
+	// at most one state and patch the dangling transitions instead of copying states
+	struct Frag {
+		uint32_t start;
+		uint32_t outFirst;	// First and last dangling transitions (indices in edges)
+		uint32_t outLast;
+	};
+	// A fragment built once, to be copied by offset at each use of a shared subexpression:
+	// its edges, with the states and the links of the dangling transitions numbered from 0
+	struct Template {
+		vector<Edge> edges;		// Set labels are 129 + i for the i-th set of the DAG
+		vector<bool> linked;	// Whether the to of each edge links dangling transitions (an edge index)
+		uint32_t nstates;
+		Frag frag;
+		Template() : nstates(0) {}
+	};
+	NFA() : nstates(0) {}
+	inline size_t get_size()const { return nstates; }
+	inline size_t get_num_edges()const { return tran.size() + eps.size(); }
+	uint32_t add_set(const CharSet& cs);
+	Frag opt_label(uint32_t label);
+	Frag opt_union(Frag lhs, Frag rhs);
+	Frag opt_concat(Frag lhs, Frag rhs);
+	Frag opt_star(Frag f);
+	Frag opt_plus(Frag f);
+	Frag opt_quest(Frag f);
+	void finish(Frag f);
+	Template save_template(Frag f)const;
+	Frag opt_copy(const Template& t, const vector<uint32_t>& setLabel);
 	vector<size_t> merge_nfa(const vector<NFA>&);
-	vector<size_t> epsilon_closure(size_t s)const;
-	vector<size_t> epsilon_closure(const vector<size_t>& ss)const;
-	vector<size_t> move(const vector<size_t>& ss, char a)const;
+	// The following need the row form (built by merge_nfa)
+	vector<uint32_t> epsilon_closure(uint32_t s)const;
+	vector<uint32_t> epsilon_closure(const vector<uint32_t>& ss)const;
+	vector<uint32_t> move(const vector<uint32_t>& ss, char a)const;
+	void move_closure(const uint32_t* first, const uint32_t* last, size_t a, SparseSet& scratch, vector<uint32_t>& res)const;
+	size_t char_classes(array<size_t, 256>& ec)const;
+	inline const vector<uint32_t>& get_tran_start()const { return tranStart; }
+	inline const vector<Tran>& get_tran()const { return tran; }
+	inline const vector<size_t>& get_clos_start()const { return closStart; }
+	inline const vector<uint32_t>& get_closure()const { return closure; }
+	inline bool label_has(uint32_t label, size_t a)const { return label == a || (label > 128 && sets[label - 129].test(a)); }
 	~NFA() {}
 private:
-	deque<NST> Ntran;		// Set of states (faster random access and double end add/delete with deque)
+	uint32_t nstates;			// Number of states
+	vector<Edge> edges;			// All transitions, in construction form
+	vector<CharSet> sets;		// Character sets used as labels
+	vector<uint32_t> tranStart;	// Character transitions of state s are tran[tranStart[s], tranStart[s + 1])
+	vector<Tran> tran;
+	vector<uint32_t> epsStart;	// ε transitions of state s are eps[epsStart[s], epsStart[s + 1])
+	vector<uint32_t> eps;
+	vector<size_t> closStart;	// Precomputed epsilon closures of single states:
+	vector<uint32_t> closure;	// the closure of state s is closure[closStart[s], closStart[s + 1])
+	void build_rows();
+	uint32_t append_sets(const NFA& rhs);
+	uint32_t add_dangling(uint32_t from);
+	void patch(uint32_t first, uint32_t to);
+};
+
+// Regular expressions as a DAG of hash-consed nodes:
+// Equal subexpressions are a single node, so every definition is parsed once and the
+// rules and later definitions that use it refer to its node instead of a copy of its text.
+// The constructions walk a rule as the tree it stands for (expand), and a shared node
+// still gets its own states or positions at each use, since each use matches apart; but the
+// construction of a node that is reached more than once (shared_nodes) is built at its first
+// use and copied by offset at the others, instead of walking its subtree again
+class RegexDag {
+public:
+	struct Node {
+		int op;				// Operator ('|', '&', '*', '+', '?'), 0 for an operand
+		int sym;			// Operand: ASCII character, or CHARSET_BASE + i for get_set(i)
+		uint32_t left, right;	// Children (right = left for unary operators)
+		uint64_t hash;		// Hash of the whole subexpression
+	};
+	uint32_t add_suffix(const vector<int>& suffix, const vector<CharSet>& charSets, const vector<uint32_t>& defRoots);
+	void expand(uint32_t root, vector<uint32_t>& order, const vector<bool>* stop = 0)const;
+	vector<bool> shared_nodes(const vector<uint32_t>& roots)const;
+	inline size_t get_size()const { return nodes.size(); }
+	inline const Node& get_node(uint32_t i)const { return nodes[i]; }
+	inline size_t get_num_sets()const { return sets.size(); }
+	inline const CharSet& get_set(size_t i)const { return sets[i]; }
+private:
+	vector<Node> nodes;
+	vector<CharSet> sets;							// Distinct character sets of the operands
+	map<std::pair<uint64_t, uint64_t>, int> setIndex;	// Members of a set -> its operand symbol
+	map<std::tuple<int, int, uint32_t, uint32_t>, uint32_t> nodeIndex;	// Hash-consing table
+	uint32_t add_node(int op, int sym, uint32_t left, uint32_t right);
+};
+
+// Syntax tree of all rules, for the direct construction of the DFA (followpos):
+// Every operand is a leaf with its own position, and every rule gets an end marker position,
+// so the tree is (r0)#0 | (r1)#1 | ... and the DFA can be built without ε transitions
+class RegexTree {
+public:
+	struct Node {
+		int op;						// Operator ('|', '&', '*', '+', '?'), 0 for a leaf
+		uint32_t left, right;		// Children (right = left for unary operators, the position for a leaf)
+		bool nullable;
+		vector<uint32_t> firstpos;	// Sorted sets of positions
+		vector<uint32_t> lastpos;
+	};
+	void add_rule(const RegexDag& dag, uint32_t root, const vector<bool>& shared);
+	void finish();
+	size_t char_classes(array<size_t, 256>& ec)const;
+	inline size_t get_positions()const { return labels.size(); }
+	inline const CharSet& get_label(size_t p)const { return labels[p]; }
+	inline size_t get_accept(size_t p)const { return posAccept[p]; }
+	inline const vector<uint32_t>& get_followpos(size_t p)const { return followpos[p]; }
+	inline const vector<uint32_t>& get_start()const { return start; }
+private:
+	vector<Node> nodes;
+	vector<uint32_t> roots;				// Root of each rule, (rule)#
+	vector<CharSet> labels;				// Characters matched by each position (none for end markers)
+	vector<size_t> posAccept;			// Rule of each end marker, -1 for the other positions
+	vector<vector<uint32_t>> followpos;	// Sorted followpos of each position
+	vector<uint32_t> start;				// firstpos of the whole tree
+	struct Copy {						// The subtree of a shared DAG node, built at its first use
+		uint32_t firstPos, endPos;		// Its positions
+		uint32_t node;					// Its root
+		vector<vector<uint32_t>> followpos;	// followpos of its positions within the subtree
+	};
+	map<uint32_t, Copy> copies;			// By DAG node
+	uint32_t add_leaf(const CharSet& cs, size_t rule);
+	uint32_t add_node(int op, uint32_t left, uint32_t right);
+	uint32_t add_subtree(const RegexDag& dag, uint32_t root, const vector<bool>& shared);
+	uint32_t copy_subtree(const Copy& c);
+};
+
+// Counters of the subset construction, for --stats
+struct BuildCounters {
+	size_t closureCalls;	// ε-closures of moves (none for the followpos engine)
+	size_t internLookups;	// Lookups of state sets in the table of DFA states
+	size_t internHits;		// Lookups that found a state already built
+	BuildCounters() : closureCalls(0), internLookups(0), internHits(0) {}
 };
 
 // Deterministic finite automata:
-// The state set is all lines of Dtran
-// Enter the alphabet as ASCII characters (128 columns)
+// The state set is all rows of Dtran
+// The input bytes are divided into equivalence classes (member ec), and the alphabet is the classes
 // Convert function to member Dtran
-// The first line of Dtran when the start state
+// The first row of Dtran when the start state
 // The acceptance status is reflected in the member accepts
 class DFA {
 public:
-	typedef array<size_t, 128> DST;		// Each row in the DFA state table: Transitions to other states
-										// Each row contains 128 size t
-										// Represents the successor on 128 ASCII, with none for empty
-	DFA(const NFA& , const vector<size_t>& );
-	// DFA(const NFA& , size_t );
-	inline size_t get_size()const { return Dtran.size(); }
-	inline size_t get_tran(size_t i, size_t ch)const { return Dtran[i][ch]; }
+	DFA(const NFA& , const vector<size_t>& , unsigned threads = 1);
+	DFA(const RegexTree& );
+	DFA() : nclasses(0) {}			// Empty, to be loaded
+	inline size_t get_size()const { return accepts.size(); }
+	inline size_t get_num_classes()const { return nclasses; }
+	inline size_t get_class(size_t ch)const { return ec[ch]; }
+	inline size_t get_tran(size_t i, size_t c)const { return Dtran[i * nclasses + c]; }
 	inline const vector<size_t> get_accepts()const { return accepts; }
+	inline const BuildCounters& get_counters()const { return counters; }
+	size_t get_num_edges()const;
 	void minimize();
 	void delete_dead_states();
+	bool save(ostream& os, uint64_t key, const string& rules)const;
+	bool load(istream& is, uint64_t key, const string& rules, size_t nrules);
 private:
-	vector<DST> Dtran;				// state transition
+	size_t nclasses;				// Number of equivalence classes
+	array<size_t, 256> ec;			// Equivalence class of each byte, class 0 has no transitions
+	vector<size_t> Dtran;			// state transition: the row of state i is Dtran[i * nclasses, (i + 1) * nclasses)
+									// with -1 for no conversion
 	vector<size_t> accepts;			// The mode number corresponds to the accepted state, and the mode number corresponds to -1 for the non-accepted state
+	BuildCounters counters;			// How the automaton was built (zero when loaded)
 
-	DST newDST() {					// -1 indicates no conversion
-		DST st;
-		for (size_t& i : st) {
-			i = -1;
-		}
-		return st;
+	void build_parallel(const NFA&, const vector<size_t>&, const vector<size_t>&, unsigned);
+	void add_state() {				// -1 indicates no conversion
+		Dtran.insert(Dtran.end(), nclasses, -1);
 	}
 };
\ No newline at end of file
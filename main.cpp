@@ -1,15 +1,117 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <cstdlib>
 #include "Lex.h"
 using namespace std;
 
 // C:\\Users\\Lenovo\\projects\\cpp1\\minic.l
 
-int main() {
-	cout << "Input the lex file name ending up with \".l\"\n>>> ";
+void print_usage(const char* prog) {
+	cout << "Usage: " << prog << " [options] [lex file]\n"
+		 << "Options:\n"
+		 << "  --engine=thompson    Thompson construction and subset construction (default)\n"
+		 << "  --engine=followpos   Direct construction of the DFA from the syntax tree\n"
+		 << "  --threads=N          Threads for the Thompson engine (default: all hardware threads)\n"
+		 << "  --cache-dir=DIR      Reuse the DFA compiled from the same rules, cached in DIR\n"
+		 << "  --lazy-dfa           Emit the NFA and a lexer that builds the DFA states on demand\n"
+		 << "  --stats[=json]       Report phase times, peak memory and automaton sizes on stderr\n"
+		 << "  --rule-report        Report on stderr how many DFA states each rule adds\n"
+		 << "  --backup-report      Report on stderr the DFA states that back up, and their rules\n"
+		 << "  --tables=full        One row of next states per DFA state (default)\n"
+		 << "  --tables=compressed  Rows packed by row displacement with default states\n"
+		 << "  --backend=table      Table-driven scanner (default)\n"
+		 << "  --backend=goto       Direct-coded scanner, one block of code per DFA state\n"
+		 << "  --yytext=copy        Copy each token into the yytext array (default)\n"
+		 << "  --yytext=pointer     yytext points into the input, with length yyleng\n"
+		 << "  --input=string       The input is one NUL-terminated string at p (default)\n"
+		 << "  --input=stream       Read yyin through a buffer refilled as the input is scanned\n"
+		 << "  --input=mmap         Scan a file mapped into memory by yy_map_file, in place\n"
+		 << "  --reentrant          Keep the scanner state in a yyscan_t context, for one scanner per thread\n"
+		 << "  --parallel           Also emit yylex_parallel, which scans one buffer on several threads\n";
+}
+
+int main(int argc, char* argv[]) {
+	LexOptions opts;
 	string infile;
-	cin >> infile;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--engine=thompson") {
+			opts.engine = LexOptions::THOMPSON;
+		}
+		else if (arg == "--engine=followpos") {
+			opts.engine = LexOptions::FOLLOWPOS;
+		}
+		else if (arg.compare(0, 10, "--threads=") == 0) {
+			opts.threads = atoi(arg.c_str() + 10);
+		}
+		else if (arg.compare(0, 12, "--cache-dir=") == 0) {
+			opts.cacheDir = arg.substr(12);
+		}
+		else if (arg == "--lazy-dfa") {
+			opts.lazyDfa = true;
+		}
+		else if (arg == "--stats") {
+			opts.stats = LexOptions::STATS_TEXT;
+		}
+		else if (arg == "--stats=json") {
+			opts.stats = LexOptions::STATS_JSON;
+		}
+		else if (arg == "--rule-report") {
+			opts.ruleReport = true;
+		}
+		else if (arg == "--backup-report") {
+			opts.backupReport = true;
+		}
+		else if (arg == "--tables=full") {
+			opts.tables = LexOptions::FULL_TABLES;
+		}
+		else if (arg == "--tables=compressed") {
+			opts.tables = LexOptions::COMPRESSED_TABLES;
+		}
+		else if (arg == "--backend=table") {
+			opts.backend = LexOptions::TABLE_BACKEND;
+		}
+		else if (arg == "--backend=goto") {
+			opts.backend = LexOptions::GOTO_BACKEND;
+		}
+		else if (arg == "--yytext=copy") {
+			opts.text = LexOptions::COPY_TEXT;
+		}
+		else if (arg == "--yytext=pointer") {
+			opts.text = LexOptions::POINTER_TEXT;
+		}
+		else if (arg == "--input=string") {
+			opts.input = LexOptions::STRING_INPUT;
+		}
+		else if (arg == "--input=stream") {
+			opts.input = LexOptions::STREAM_INPUT;
+		}
+		else if (arg == "--input=mmap") {
+			opts.input = LexOptions::MMAP_INPUT;
+		}
+		else if (arg == "--reentrant") {
+			opts.reentrant = true;
+		}
+		else if (arg == "--parallel") {
+			opts.parallel = true;
+		}
+		else if (arg[0] != '-' && infile.empty()) {
+			infile = arg;
+		}
+		else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!options_error(opts).empty()) {
+		cout << options_error(opts) << endl;
+		return 1;
+	}
+	if (infile.empty()) {
+		cout << "Input the lex file name ending up with \".l\"\n>>> ";
+		cin >> infile;
+	}
 	// filename ends up with ".l"
 	if (infile.size() > 2 && infile[infile.size() - 2] == '.' && infile[infile.size() - 1] == 'l') {
 		ifstream ifs(infile.c_str());
@@ -22,13 +124,16 @@ int main() {
 				cout << "Can not write the C file!" << endl;
 			}
 			else {
-				int errline = ParseLexFile(ifs, ofs);
+				int errline = ParseLexFile(ifs, ofs, opts);
 				if (errline == 0) {
 					cout << "Output the C file lex.yy.c." << endl;
 				}
 				else if (errline == -1) {
 					cout << "Regular expression lexical error." << endl;
 				}
+				else if (errline == -2) {
+					cout << options_error(opts) << endl;
+				}
 				else {
 					cout << "Lex file error in line " << errline << " ." << endl;
 				}
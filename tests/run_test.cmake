@@ -0,0 +1,51 @@
+# Run one lexer test (ctest runs it with cmake -P):
+# Generate a lexer from LEX with the generator GEN and its OPTIONS in WORKDIR, RUNS times (once by
+# default; with --cache-dir, the second run reads the DFA that the first one saved). What the last
+# run writes to stderr must match the regular expression MATCH, and without an INPUT, equal the
+# file EXPECTED (the reports of the generator). With an INPUT, compile the lexer with CC and CFLAGS,
+# run it on INPUT in WORKDIR and compare what it writes (to OUTPUT, a file in WORKDIR, or to stdout)
+# with the file EXPECTED
+file(REMOVE_RECURSE ${WORKDIR})
+file(MAKE_DIRECTORY ${WORKDIR})
+separate_arguments(OPTIONS)
+separate_arguments(CFLAGS)
+if(NOT RUNS)
+	set(RUNS 1)
+endif()
+
+foreach(run RANGE 1 ${RUNS})
+	execute_process(COMMAND ${GEN} ${OPTIONS} ${LEX} WORKING_DIRECTORY ${WORKDIR}
+		RESULT_VARIABLE result ERROR_VARIABLE report)
+	file(GLOB generated "${WORKDIR}/*lex.yy.c") # The generator writes the path of its author
+	if(NOT result EQUAL 0 OR NOT generated)
+		message(FATAL_ERROR "generating a lexer from ${LEX} failed:\n${report}")
+	endif()
+endforeach()
+if(MATCH AND NOT report MATCHES "${MATCH}")
+	message(FATAL_ERROR "the report of the generator on ${LEX} does not match ${MATCH}:\n${report}")
+endif()
+if(NOT INPUT)
+	if(EXPECTED)
+		file(READ ${EXPECTED} expected)
+		if(NOT report STREQUAL expected)
+			message(FATAL_ERROR "the report of the generator on ${LEX} differs from ${EXPECTED}:\n${report}")
+		endif()
+	endif()
+	return()
+endif()
+
+execute_process(COMMAND ${CC} ${CFLAGS} ${generated} -o ${WORKDIR}/lexer -lpthread RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "compiling the lexer of ${LEX} failed")
+endif()
+execute_process(COMMAND ${WORKDIR}/lexer ${INPUT} WORKING_DIRECTORY ${WORKDIR} OUTPUT_VARIABLE output RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "the lexer of ${LEX} failed")
+endif()
+if(OUTPUT)
+	file(READ ${WORKDIR}/${OUTPUT} output)
+endif()
+file(READ ${EXPECTED} expected)
+if(NOT output STREQUAL expected)
+	message(FATAL_ERROR "the tokens of ${LEX} on ${INPUT} differ from ${EXPECTED}:\n${output}")
+endif()